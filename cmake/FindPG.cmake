@@ -21,6 +21,7 @@
 # PG_CONFIG_PATH - The pg_config executable path
 # PG_ROOT_DIR - The base install directory for PostgreSQL
 # PG_INCLUDE_DIRS - The directory containing the PostgreSQL headers.
+# PG_SERVER_INCLUDE_DIRS - The directories containing the PostgreSQL server headers.
 # PG_LIBRARIES - The PostgreSQL client libraries.
 # PG_LIBRARY_DIRS - The directory containing the PostgreSQL client libraries.
 # PG_PKG_LIBRARY_DIRS - The directory containing the PostgreSQL package libraries.
@@ -81,6 +82,7 @@ IF(NOT _retval)
     IF(WIN32 AND NOT CYGWIN AND NOT MSYS)
 
         SET(PG_INCLUDE_DIRS "${PG_ROOT_DIR}/include")
+        SET(PG_SERVER_INCLUDE_DIRS "${PG_ROOT_DIR}/include/server" "${PG_ROOT_DIR}/include/server/port/win32" "${PG_ROOT_DIR}/include/server/port/win32_msvc")
         SET(PG_LIBRARY_DIRS "${PG_ROOT_DIR}/lib")
         SET(PG_PKG_LIBRARY_DIRS "${PG_ROOT_DIR}/lib")
         SET(PG_SHARE_DIR "${PG_ROOT_DIR}/share")
@@ -91,6 +93,7 @@ IF(NOT _retval)
     ELSE(WIN32 AND NOT CYGWIN AND NOT MSYS)
 
         EXEC_PROGRAM(${PG_CONFIG_PATH} ARGS --includedir OUTPUT_VARIABLE PG_INCLUDE_DIRS)
+        EXEC_PROGRAM(${PG_CONFIG_PATH} ARGS --includedir-server OUTPUT_VARIABLE PG_SERVER_INCLUDE_DIRS)
         EXEC_PROGRAM(${PG_CONFIG_PATH} ARGS --libdir OUTPUT_VARIABLE PG_LIBRARY_DIRS)
         EXEC_PROGRAM(${PG_CONFIG_PATH} ARGS --pkglibdir OUTPUT_VARIABLE PG_PKG_LIBRARY_DIRS)
         EXEC_PROGRAM(${PG_CONFIG_PATH} ARGS --sharedir OUTPUT_VARIABLE PG_SHARE_DIR)
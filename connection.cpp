@@ -11,74 +11,283 @@
 
 #include "pgAgent.h"
 #include <string>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <unordered_map>
+#include <unordered_set>
+
+#if !BOOST_OS_WINDOWS
+#include <errno.h>
+#include <poll.h>
+#endif
 
 namespace ip = boost::asio::ip;
 
 DBconn   *DBconn::ms_primaryConn = NULL;
 CONNinfo  DBconn::ms_basicConnInfo;
 
+// Protects the primary connection
 static boost::mutex  s_poolLock;
 
-DBconn::DBconn(const std::string &connectString)
-: m_inUse(false), m_next(NULL), m_prev(NULL), m_minorVersion(0),
-	m_majorVersion(0)
+// The pooled connections are spread over a number of shards by the hash of
+// their connection string, each with its own lock, so that the threads using
+// different databases don't wait for each other. Within a shard, the idle
+// connections are kept in a free list per connection string.
+#define POOL_SHARDS 16
+
+// Number of rows received at a time by ExecuteAsync(), with libpq 17
+#define STREAMED_ROWS_CHUNK 1000
+
+// Seconds before pre-warming again after a failure, doubled on each failure
+// in a row, up to the maximum.
+#define POOL_RETRY_DELAY     5
+#define POOL_RETRY_MAX_DELAY 300
+
+// What the pool knows of a connection string, besides its connections
+struct PoolTargetState
+{
+	PoolTargetState() : failures(0) {}
+
+	// The last time a job took a connection for it
+	std::chrono::steady_clock::time_point lastUsed;
+
+	// No pre-warming before then, after 'failures' failed ones in a row
+	std::chrono::steady_clock::time_point retryAfter;
+	int                                   failures;
+};
+
+struct PoolShard
+{
+	boost::mutex                                             lock;
+	std::unordered_map<std::string, std::vector<DBconn *> >  idle;
+	std::unordered_set<DBconn *>                             inUse;
+
+	// Number of connections being opened to be added to 'idle'
+	std::unordered_map<std::string, long>                    connecting;
+	std::unordered_map<std::string, PoolTargetState>         targets;
+};
+
+static PoolShard s_pool[POOL_SHARDS];
+
+// Returns the normalized connection string for the given connection string,
+// or database on the primary server, and the shard of the pool it belongs to.
+bool DBconn::PoolKey(
+	const std::string &_connStr, const std::string &db,
+	std::string &connStr, size_t &shardNo
+)
+{
+	if (!_connStr.empty())
+	{
+		CONNinfo connInfo;
+		if (!connInfo.Set(_connStr))
+		{
+			LOG_MESSAGE(
+				"Failed to parse the connection string \"" + _connStr +
+				"\" with error: " + connInfo.GetError(), LOG_WARNING
+			);
+			return false;
+		}
+		connStr = connInfo.Get();
+	}
+	else
+	{
+		connStr = ms_basicConnInfo.Get(db);
+	}
+
+	// The connection strings are normalized by CONNinfo, so that the same
+	// database is always found under the same key.
+	shardNo = std::hash<std::string>()(connStr) % POOL_SHARDS;
+
+	return true;
+}
+
+
+DBconn::DBconn(const std::string &connectString, bool connect)
+: m_minorVersion(0), m_majorVersion(0), m_conn(NULL), m_inUse(false), m_shard(0)
 {
 	m_connStr = connectString;
+	m_created = m_lastUsed = std::chrono::steady_clock::now();
+
+	if (connect)
+		Connect();
+}
+
 
-	Connect(connectString);
+// Blocks until the connection is made, so it must never be called from the
+// event loop itself.
+bool DBconn::Connect()
+{
+	return ConnectAsync().get();
 }
 
 
-bool DBconn::Connect(const std::string &connStr)
+// Opening a connection with PQconnectStart() and PQconnectPoll(), driven by
+// the event loop. It ends as soon as the connection is either made, or has
+// failed, or --connect-timeout has expired, whichever comes first.
+class ConnectState
 {
-	LogMessage(("Creating DB connection: " + connStr), LOG_DEBUG);
-	m_conn = PQconnectdb(connStr.c_str());
+public:
+	ConnectState(DBconn *conn, const DBconn::ConnectHandler &done = DBconn::ConnectHandler())
+		: m_dbconn(conn), m_sock(-1), m_finished(false), m_done(done) {}
+
+	std::future<bool> Result() { return m_result.get_future(); }
+	bool              Finished() const { return m_finished; }
 
-	if (PQstatus(m_conn) != CONNECTION_OK)
+	static void Poll(std::shared_ptr<ConnectState> self, PostgresPollingStatusType status)
 	{
-		m_lastError = (const char *)PQerrorMessage(m_conn);
-		PQfinish(m_conn);
-		m_conn = NULL;
+		if (self->m_finished)
+			return;
 
-		return false;
+		switch (status)
+		{
+			case PGRES_POLLING_OK:
+				self->Finish(true, "");
+				return;
+
+			case PGRES_POLLING_FAILED:
+				self->Finish(false, PQerrorMessage(self->m_dbconn->m_conn));
+				return;
+
+			case PGRES_POLLING_READING:
+			case PGRES_POLLING_WRITING:
+				// The socket may change from one call to the next, when trying
+				// several addresses.
+				self->m_sock = PQsocket(self->m_dbconn->m_conn);
+
+				EventLoop::Get().WaitSocket(
+					self->m_sock, status == PGRES_POLLING_WRITING,
+					[self](bool ready)
+					{
+						if (self->m_finished)
+							return;
+
+						if (!ready)
+						{
+							self->Finish(false, "Failed to wait for the connection");
+							return;
+						}
+
+						self->m_sock = -1;
+						Poll(self, PQconnectPoll(self->m_dbconn->m_conn));
+					}
+				);
+				return;
+
+			default:
+				EventLoop::Get().Post([self]()
+				{
+					Poll(self, PQconnectPoll(self->m_dbconn->m_conn));
+				});
+				return;
+		}
+	}
+
+	void Finish(bool ok, const std::string &error)
+	{
+		m_finished = true;
+		EventLoop::Get().Cancel(m_timeout);
+
+		if (!ok)
+		{
+			if (m_sock >= 0)
+				EventLoop::Get().CancelWait(m_sock);
+
+			m_dbconn->m_lastError = error;
+			if (m_dbconn->m_conn)
+				PQfinish(m_dbconn->m_conn);
+			m_dbconn->m_conn = NULL;
+		}
+
+		m_result.set_value(ok);
+
+		// Last, as it may delete the connection
+		if (m_done)
+			m_done(ok);
 	}
 
-	return (m_conn != NULL);
+	EventLoop::Timer    m_timeout;
+
+private:
+	DBconn             *m_dbconn;
+	int                 m_sock;
+	bool                m_finished;
+	std::promise<bool>  m_result;
+	DBconn::ConnectHandler  m_done;
+};
+
+
+// Start opening the connection, without waiting for it. The connection must
+// not be used, nor deleted, until the result is known.
+std::future<bool> DBconn::ConnectAsync()
+{
+	std::shared_ptr<ConnectState> state(new ConnectState(this));
+	std::future<bool> result = state->Result();
+
+	StartConnect(state);
+
+	return result;
 }
 
 
-DBconn::~DBconn()
+// The same, with 'done' called with the result instead, from the event loop
+// (or at once, if the connection fails to start).
+void DBconn::ConnectAsync(const ConnectHandler &done)
 {
-	// clear a single connection
-	if (m_conn)
+	StartConnect(std::shared_ptr<ConnectState>(new ConnectState(this, done)));
+}
+
+
+void DBconn::StartConnect(std::shared_ptr<ConnectState> state)
+{
+	LOG_MESSAGE(("Creating DB connection: " + m_connStr), LOG_DEBUG);
+	m_conn = PQconnectStart(m_connStr.c_str());
+
+	if (m_conn == NULL || PQstatus(m_conn) == CONNECTION_BAD)
 	{
-		PQfinish(m_conn);
-		m_conn = NULL;
+		state->Finish(false, m_conn ? PQerrorMessage(m_conn) : "Out of memory");
+		return;
 	}
+
+	// Everything else happens in the event loop, including the time out, so
+	// that the handlers never run at the same time.
+	EventLoop::Get().Post([state]()
+	{
+		if (connectTimeout > 0)
+		{
+			state->m_timeout = EventLoop::Get().After(
+				std::chrono::milliseconds(connectTimeout * 1000),
+				[state]() { if (!state->Finished()) state->Finish(false, "Timeout expired"); }
+			);
+		}
+
+		ConnectState::Poll(state, PGRES_POLLING_WRITING);
+	});
 }
 
 
-std::string DBconn::qtDbString(const std::string &value)
+// A connection which has been open for longer than --pool-max-lifetime, or
+// has been broken, is not reused.
+bool DBconn::IsReusable(const std::chrono::steady_clock::time_point &now) const
 {
-	std::string result = value;
+	if (m_conn == NULL || PQstatus(m_conn) != CONNECTION_OK)
+		return false;
+
+	return poolMaxLifetime <= 0 || now - m_created < std::chrono::seconds(poolMaxLifetime);
+}
 
-	boost::replace_all(result, "\\", "\\\\");
-	boost::replace_all(result, "'", "''");
-	result.append("'");
 
-	if (BackendMinimumVersion(8, 1))
+DBconn::~DBconn()
+{
+	// clear a single connection
+	if (m_conn)
 	{
-		if (result.find("\\") != std::string::npos)
-			result.replace(0, 0, "E'");
-		else
-			result.replace(0, 0, "'");
+		PQfinish(m_conn);
+		m_conn = NULL;
 	}
-	else
-		result.replace(0, 0, "'");
-
-	return result;
 }
 
+
 bool DBconn::BackendMinimumVersion(int major, int minor)
 {
 	if (!m_majorVersion)
@@ -124,7 +333,7 @@ DBconn *DBconn::InitConnection(const std::string &connectString)
 		delete ms_primaryConn;
 		ms_primaryConn = NULL;
 
-		LogMessage(
+		LOG_MESSAGE(
 			"Failed to create primary connection: " + error, LOG_WARNING
 		);
 		return NULL;
@@ -138,64 +347,75 @@ DBconn *DBconn::InitConnection(const std::string &connectString)
 DBconn *DBconn::Get(const std::string &_connStr, const std::string &db)
 {
 	std::string connStr;
-	if (!_connStr.empty())
-	{
-		CONNinfo connInfo;
-		if (!connInfo.Set(_connStr))
-		{
-			LogMessage(
-				"Failed to parse the connection string \"" + _connStr +
-				"\" with error: " + connInfo.GetError(), LOG_WARNING
-			);
-			return NULL;
-		}
-		connStr = connInfo.Get();
-	}
-	else
-	{
-		connStr = DBconn::ms_basicConnInfo.Get(db);
-	}
+	size_t      shardNo;
 
-	MutexLocker locker(&s_poolLock);
+	if (!PoolKey(_connStr, db, connStr, shardNo))
+		return NULL;
 
-	DBconn *thisConn = ms_primaryConn;
-	DBconn *lastConn = NULL;
+	PoolShard &shard = s_pool[shardNo];
+	std::vector<DBconn *> stale;
+	DBconn *thisConn = NULL;
 
-	// find an existing connection
-	do
 	{
-		if (thisConn && !thisConn->m_inUse && thisConn->m_connStr == connStr)
+		MutexLocker locker(&shard.lock);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		shard.targets[connStr].lastUsed = now;
+
+		// find an existing connection, the most recently used one first, so
+		// that the others go idle and can be closed.
+		std::unordered_map<std::string, std::vector<DBconn *> >::iterator it =
+			shard.idle.find(connStr);
+
+		while (it != shard.idle.end() && !it->second.empty() && thisConn == NULL)
 		{
-			LogMessage((
-				"Using the existing connection '" +
-				CONNinfo::Parse(thisConn->m_connStr, NULL, NULL, true) +
-				"'..."), LOG_DEBUG
-			);
-			thisConn->m_inUse = true;
+			thisConn = it->second.back();
+			it->second.pop_back();
 
-			return thisConn;
+			if (!thisConn->IsReusable(now))
+			{
+				stale.push_back(thisConn);
+				thisConn = NULL;
+			}
 		}
 
-		lastConn = thisConn;
 		if (thisConn != NULL)
-			thisConn = thisConn->m_next;
+		{
+			thisConn->m_inUse = true;
+			shard.inUse.insert(thisConn);
+		}
+	}
 
-	} while (thisConn != NULL);
+	for (size_t i = 0; i < stale.size(); i++)
+		delete stale[i];
+
+	if (thisConn != NULL)
+	{
+		LOG_MESSAGE((
+			"Using the existing connection '" +
+			CONNinfo::Parse(thisConn->m_connStr, NULL, NULL, true) +
+			"'..."), LOG_DEBUG
+		);
 
+		return thisConn;
+	}
 
-	// No suitable connection was found, so create a new one.
+	// No suitable connection was found, so create a new one. Connecting may
+	// take a while, so don't keep the other threads waiting meanwhile.
 	DBconn *newConn = new DBconn(connStr);
 
 	if (newConn && newConn->m_conn)
 	{
-		LogMessage((
+		LOG_MESSAGE((
 			"Allocating new connection for the database with connection string: " +
 			CONNinfo::Parse(newConn->m_connStr, NULL, NULL, true) + "..."
 			), LOG_DEBUG);
 
+		MutexLocker locker(&shard.lock);
+
 		newConn->m_inUse = true;
-		newConn->m_prev = lastConn;
-		lastConn->m_next = newConn;
+		newConn->m_shard = shardNo;
+		shard.inUse.insert(newConn);
 	}
 	else
 	{
@@ -227,88 +447,293 @@ DBconn *DBconn::Get(const std::string &_connStr, const std::string &db)
 
 void DBconn::Return()
 {
-	MutexLocker locker(&s_poolLock);
-
 	// Cleanup
 	ExecuteVoid("RESET ALL");
 	m_lastError.clear();
-	m_inUse = false;
 
-	LogMessage((
-		"Returning the connection to the connection pool: '" +
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	bool reusable = IsReusable(now);
+
+	{
+		PoolShard &shard = s_pool[m_shard];
+		MutexLocker locker(&shard.lock);
+
+		m_inUse = false;
+		shard.inUse.erase(this);
+
+		if (reusable)
+		{
+			std::vector<DBconn *> &idle = shard.idle[m_connStr];
+
+			if ((long)idle.size() < poolMaxIdle)
+			{
+				LOG_MESSAGE((
+					"Returning the connection to the connection pool: '" +
+					CONNinfo::Parse(m_connStr, NULL, NULL, true) + "'..."
+					), LOG_DEBUG);
+
+				m_lastUsed = now;
+				idle.push_back(this);
+				return;
+			}
+		}
+	}
+
+	LOG_MESSAGE((
+		"Closing the connection instead of returning it to the connection pool: '" +
 		CONNinfo::Parse(m_connStr, NULL, NULL, true) + "'..."
 		), LOG_DEBUG);
+
+	delete this;
 }
 
-void DBconn::ClearConnections(bool all)
+
+// Open connections to the given databases, until there are as many idle ones
+// as asked for (up to --pool-max-idle), so that the jobs about to start don't
+// have to wait for them. The connections are all opened at the same time, on
+// the event loop, which adds each of them to the pool once it is open: the
+// caller doesn't wait for any of them.
+void DBconn::Prewarm(const std::vector<PoolTarget> &targets)
 {
-	MutexLocker locker(&s_poolLock);
+	for (size_t t = 0; t < targets.size(); t++)
+	{
+		std::string connStr;
+		size_t      shardNo;
+		long        missing;
 
-	if (all)
-		LogMessage("Clearing all connections", LOG_DEBUG);
-	else
-		LogMessage("Clearing inactive connections", LOG_DEBUG);
+		if (!PoolKey(targets[t].connStr, targets[t].db, connStr, shardNo))
+			continue;
 
-	DBconn *thisConn = ms_primaryConn, *deleteConn;
-	int total = 0, free = 0, deleted = 0;
+		{
+			MutexLocker locker(&s_pool[shardNo].lock);
+			std::unordered_map<std::string, PoolTargetState>::iterator state =
+				s_pool[shardNo].targets.find(connStr);
 
-	if (thisConn)
-	{
+			// Don't keep trying a database which can't be reached
+			if (state != s_pool[shardNo].targets.end() &&
+				std::chrono::steady_clock::now() < state->second.retryAfter)
+				continue;
 
-		total++;
+			long &connecting = s_pool[shardNo].connecting[connStr];
 
-		// Find the last connection
-		while (thisConn->m_next != NULL)
-		{
-			total++;
+			missing = std::min(targets[t].count, poolMaxIdle) -
+				(long)s_pool[shardNo].idle[connStr].size() - connecting;
+			if (missing > 0)
+				connecting += missing;
+		}
 
-			if (!thisConn->m_inUse)
-				free++;
+		while (missing-- > 0)
+		{
+			DBconn *newConn = new DBconn(connStr, false);
 
-			thisConn = thisConn->m_next;
+			// Handed to the pool once open, from the event loop
+			newConn->ConnectAsync([newConn, shardNo](bool ok)
+			{
+				PoolShard &shard = s_pool[shardNo];
+
+				if (ok)
+					LOG_MESSAGE((
+						"Pre-warmed a connection for connection string: " +
+						CONNinfo::Parse(newConn->m_connStr, NULL, NULL, true)
+						), LOG_DEBUG);
+				else
+					LOG_MESSAGE(
+						"Failed to pre-warm a connection for connection string '" +
+						CONNinfo::Parse(newConn->m_connStr, NULL, NULL, true) + "': " +
+						newConn->GetLastError(), LOG_WARNING
+					);
+
+				{
+					MutexLocker locker(&shard.lock);
+
+					PoolTargetState &state = shard.targets[newConn->m_connStr];
+
+					if (--shard.connecting[newConn->m_connStr] <= 0)
+						shard.connecting.erase(newConn->m_connStr);
+					if (ok)
+					{
+						state.failures = 0;
+						newConn->m_shard = shardNo;
+						shard.idle[newConn->m_connStr].push_back(newConn);
+						return;
+					}
+
+					long delay = POOL_RETRY_DELAY << std::min(state.failures, 6);
+
+					state.failures++;
+					state.retryAfter = std::chrono::steady_clock::now() +
+						std::chrono::seconds(std::min<long>(delay, POOL_RETRY_MAX_DELAY));
+				}
+
+				delete newConn;
+			});
 		}
-		if (!thisConn->m_inUse)
-			free++;
+	}
+}
+
+
+// Close the idle connections which have been idle for longer than
+// --pool-idle-timeout, keeping --pool-min-idle of them per connection string,
+// or open for longer than --pool-max-lifetime. Replace the latter ones, if
+// need be, to keep --pool-min-idle ones. Only the connection strings which a
+// job has used within --pool-idle-timeout get the minimum.
+void DBconn::MaintainPool()
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::vector<DBconn *> stale;
+	std::vector<PoolTarget> missing;
+	int idle = 0;
+
+	for (int i = 0; i < POOL_SHARDS; i++)
+	{
+		PoolShard &shard = s_pool[i];
+		MutexLocker locker(&shard.lock);
+		std::unordered_map<std::string, std::vector<DBconn *> >::iterator it = shard.idle.begin();
 
-		// Delete connections as required
-		// If a connection is not in use, delete it, and reset the next and previous
-		// pointers appropriately. If it is in use, don't touch it.
-		while (thisConn->m_prev != NULL)
+		while (it != shard.idle.end())
 		{
-			if ((!thisConn->m_inUse) || all)
+			std::vector<DBconn *> &conns = it->second;
+			std::vector<DBconn *> keep;
+			std::unordered_map<std::string, PoolTargetState>::iterator state =
+				shard.targets.find(it->first);
+			long minIdle = 0;
+
+			if (state != shard.targets.end() && (poolIdleTimeout <= 0 ||
+				now - state->second.lastUsed < std::chrono::seconds(poolIdleTimeout)))
+				minIdle = poolMinIdle;
+
+			// The oldest ones come first.
+			for (size_t c = 0; c < conns.size(); c++)
 			{
-				deleteConn = thisConn;
-				thisConn = deleteConn->m_prev;
-				thisConn->m_next = deleteConn->m_next;
-				if (deleteConn->m_next)
-					deleteConn->m_next->m_prev = deleteConn->m_prev;
-				delete deleteConn;
-				deleted++;
+				long left = (long)(conns.size() - c + keep.size());
+
+				if (!conns[c]->IsReusable(now) ||
+					(left > minIdle && poolIdleTimeout > 0 &&
+					 now - conns[c]->m_lastUsed >= std::chrono::seconds(poolIdleTimeout)))
+					stale.push_back(conns[c]);
+				else
+					keep.push_back(conns[c]);
 			}
-			else
+			conns.swap(keep);
+			idle += conns.size();
+
+			if ((long)conns.size() < minIdle)
 			{
-				thisConn = thisConn->m_prev;
+				PoolTarget target = { it->first, "", minIdle };
+				missing.push_back(target);
 			}
+
+			if (conns.empty() && minIdle <= 0)
+				it = shard.idle.erase(it);
+			else
+				++it;
+		}
+
+		// Forget the connection strings no job has used for a while
+		std::unordered_map<std::string, PoolTargetState>::iterator st =
+			shard.targets.begin();
+
+		while (st != shard.targets.end())
+		{
+			if (poolIdleTimeout > 0 &&
+				now - st->second.lastUsed >= std::chrono::seconds(poolIdleTimeout) &&
+				now >= st->second.retryAfter &&
+				shard.connecting.find(st->first) == shard.connecting.end())
+				st = shard.targets.erase(st);
+			else
+				++st;
+		}
+	}
+
+	for (size_t i = 0; i < stale.size(); i++)
+	{
+		LOG_MESSAGE((
+			"Closing the idle connection: '" +
+			CONNinfo::Parse(stale[i]->m_connStr, NULL, NULL, true) + "'..."
+			), LOG_DEBUG);
+		delete stale[i];
+	}
+
+	if (!missing.empty())
+		Prewarm(missing);
+
+	if (!stale.empty())
+		LOG_MESSAGE((boost::format(
+			"Connection pool: idle - %d, closed - %d"
+		) % idle % stale.size()).str(), LOG_DEBUG);
+}
+
+void DBconn::ClearConnections(bool all)
+{
+	if (all)
+		LOG_MESSAGE("Clearing all connections", LOG_DEBUG);
+	else
+		LOG_MESSAGE("Clearing inactive connections", LOG_DEBUG);
+
+	int total = 0, free = 0, deleted = 0;
+
+	for (int i = 0; i < POOL_SHARDS; i++)
+	{
+		PoolShard &shard = s_pool[i];
+		MutexLocker locker(&shard.lock);
+
+		// Delete the connections which are not in use. The ones in use are
+		// only deleted if we are starting all over again.
+		for (std::unordered_map<std::string, std::vector<DBconn *> >::iterator it = shard.idle.begin();
+				it != shard.idle.end(); ++it)
+		{
+			for (size_t c = 0; c < it->second.size(); c++)
+				delete it->second[c];
+
+			total += it->second.size();
+			free += it->second.size();
+			deleted += it->second.size();
+		}
+		shard.idle.clear();
+
+		total += shard.inUse.size();
+
+		if (all)
+		{
+			for (std::unordered_set<DBconn *>::iterator it = shard.inUse.begin();
+					it != shard.inUse.end(); ++it)
+				delete *it;
+
+			deleted += shard.inUse.size();
+			shard.inUse.clear();
 		}
+	}
+
+	MutexLocker locker(&s_poolLock);
+
+	if (ms_primaryConn)
+	{
+		total++;
 
 		if (all)
 		{
-			delete thisConn;
+			delete ms_primaryConn;
 			ms_primaryConn = NULL;
 			deleted++;
 		}
+	}
 
-		LogMessage((boost::format(
+	if (total > 0)
+		LOG_MESSAGE((boost::format(
 			"Connection stats: total - %d, free - %d, deleted - %d"
 		) % total % free % deleted).str(), LOG_DEBUG);
-
-	}
 	else
-		LogMessage("No connections found!", LOG_DEBUG);
+		LOG_MESSAGE("No connections found!", LOG_DEBUG);
 }
 
 
 DBresult *DBconn::Execute(const std::string &query)
+{
+	return Execute(query.c_str());
+}
+
+
+DBresult *DBconn::Execute(const char *query)
 {
 	DBresult *res = new DBresult(this, query);
 
@@ -341,6 +766,12 @@ std::string DBconn::ExecuteScalar(const std::string &query)
 
 
 int DBconn::ExecuteVoid(const std::string &query)
+{
+	return ExecuteVoid(query.c_str());
+}
+
+
+int DBconn::ExecuteVoid(const char *query)
 {
 	int rows = -1;
 	DBresultPtr res = Execute(query);
@@ -354,6 +785,509 @@ int DBconn::ExecuteVoid(const std::string &query)
 }
 
 
+// Cancels a query still running when its time is up. Once the query is over,
+// the watchdog must be stopped before the connection is used again, so that
+// no cancel request is sent afterwards. One which has been sent already may
+// still hit the next query: the connection must not be used again then.
+class QueryWatchdog
+{
+public:
+	QueryWatchdog(PGconn *conn)
+		: m_cancel(PQgetCancel(conn)), m_done(false), m_fired(false)
+	{
+	}
+
+	~QueryWatchdog()
+	{
+		if (m_cancel)
+			PQfreeCancel(m_cancel);
+	}
+
+	static std::shared_ptr<QueryWatchdog> Start(PGconn *conn, long timeout)
+	{
+		std::shared_ptr<QueryWatchdog> self(new QueryWatchdog(conn));
+
+		self->m_timer = EventLoop::Get().After(
+			std::chrono::milliseconds(timeout), [self]() { self->Fire(); }
+		);
+		return self;
+	}
+
+	// Returns true if the query has been cancelled
+	bool Stop()
+	{
+		EventLoop::Get().Cancel(m_timer);
+
+		MutexLocker locker(&m_lock);
+
+		m_done = true;
+		return m_fired;
+	}
+
+private:
+	void Fire()
+	{
+		MutexLocker locker(&m_lock);
+		char        errbuf[256];
+
+		if (m_done || m_cancel == NULL)
+			return;
+
+		m_fired = true;
+		if (!PQcancel(m_cancel, errbuf, sizeof(errbuf)))
+			LOG_MESSAGE(std::string("Failed to cancel the query: ") + errbuf, LOG_WARNING);
+	}
+
+	boost::mutex      m_lock;
+	PGcancel         *m_cancel;
+	EventLoop::Timer  m_timer;
+	bool              m_done, m_fired;
+};
+
+
+// Running a query with PQsendQuery(), driven by the event loop, without ever
+// holding more than a few of the rows it returns: they are received one at a
+// time (or in small chunks, with libpq 17 and later), counted and thrown
+// away. The connection is in non-blocking mode meanwhile, so that no handler
+// ever waits for the server.
+class StreamedQuery
+{
+public:
+	StreamedQuery(DBconn *conn, const DBconn::StreamedHandler &handler)
+		: m_dbconn(conn), m_handler(handler), m_returned(0), m_rows(-1),
+		m_rc(PGRES_FATAL_ERROR), m_failed(false), m_copyOut(false)
+	{
+	}
+
+	static void Start(
+		std::shared_ptr<StreamedQuery> self, const char *query, long timeout
+	)
+	{
+		PGconn *conn = self->m_dbconn->m_conn;
+
+		if (PQsetnonblocking(conn, 1) != 0 || !PQsendQuery(conn, query))
+		{
+			self->Fail(PQerrorMessage(conn), false);
+			return;
+		}
+
+#ifdef LIBPQ_HAS_CHUNK_MODE
+		PQsetChunkedRowsMode(conn, STREAMED_ROWS_CHUNK);
+#else
+		PQsetSingleRowMode(conn);
+#endif
+
+		if (timeout > 0)
+			self->m_watchdog = QueryWatchdog::Start(conn, timeout);
+
+		EventLoop::Get().Post([self]() { Flush(self); });
+	}
+
+private:
+	// Send what is left of the query
+	static void Flush(std::shared_ptr<StreamedQuery> self)
+	{
+		PGconn *conn = self->m_dbconn->m_conn;
+		int     rc = PQflush(conn);
+
+		if (rc < 0)
+			self->Fail(PQerrorMessage(conn), true);
+		else if (rc > 0)
+		{
+			EventLoop::Get().WaitSocket(PQsocket(conn), true, [self](bool ready)
+			{
+				if (ready)
+					Flush(self);
+				else
+					self->Fail("Failed to wait for the connection", true);
+			});
+		}
+		else
+			Drain(self);
+	}
+
+	// Wait for more from the server
+	static void Read(std::shared_ptr<StreamedQuery> self)
+	{
+		PGconn *conn = self->m_dbconn->m_conn;
+
+		EventLoop::Get().WaitSocket(PQsocket(conn), false, [self, conn](bool ready)
+		{
+			if (!ready)
+				self->Fail("Failed to wait for the connection", true);
+			else if (!PQconsumeInput(conn))
+				self->Fail(PQerrorMessage(conn), true);
+			else
+				Drain(self);
+		});
+	}
+
+	// Go through everything received so far
+	static void Drain(std::shared_ptr<StreamedQuery> self)
+	{
+		PGconn *conn = self->m_dbconn->m_conn;
+
+		while (true)
+		{
+			if (self->m_copyOut)
+			{
+				char *buffer;
+				int   len = PQgetCopyData(conn, &buffer, 1);
+
+				if (len > 0)
+				{
+					PQfreemem(buffer);
+					continue;
+				}
+				if (len == 0)
+				{
+					Read(self);
+					return;
+				}
+
+				// The end of the data, or an error which PQgetResult() reports
+				self->m_copyOut = false;
+			}
+
+			if (PQisBusy(conn))
+			{
+				Read(self);
+				return;
+			}
+
+			PGresult *res = PQgetResult(conn);
+
+			if (res == NULL)
+			{
+				self->Finish();
+				return;
+			}
+
+			switch (PQresultStatus(res))
+			{
+				case PGRES_COPY_OUT:
+					self->m_copyOut = true;
+					break;
+
+				case PGRES_COPY_IN:
+					// There is nothing to send: make the COPY fail
+					PQclear(res);
+					if (PQputCopyEnd(conn, "COPY FROM STDIN is not supported in job steps") < 0)
+						self->Fail(PQerrorMessage(conn), true);
+					else
+						Flush(self);
+					return;
+
+#if (PG_VERSION_NUM >= 90100)
+				case PGRES_COPY_BOTH:
+					PQclear(res);
+					self->Fail("Replication commands are not supported in job steps", true);
+					return;
+#endif
+
+				default:
+					self->Add(res);
+					break;
+			}
+
+			PQclear(res);
+		}
+	}
+
+	// Like PQexec(), keep the status of the last statement, unless one of
+	// them has failed.
+	void Add(PGresult *res)
+	{
+		int status = PQresultStatus(res);
+
+		switch (status)
+		{
+			case PGRES_SINGLE_TUPLE:
+#ifdef LIBPQ_HAS_CHUNK_MODE
+			case PGRES_TUPLES_CHUNK:
+#endif
+				m_returned += PQntuples(res);
+				break;
+
+			case PGRES_TUPLES_OK:
+				m_returned += PQntuples(res);
+				if (!m_failed)
+				{
+					m_rc = status;
+					m_rows = (int)m_returned;
+				}
+				break;
+
+			case PGRES_COMMAND_OK:
+				if (!m_failed)
+				{
+					m_rc = status;
+					m_rows = atoi(PQcmdTuples(res));
+				}
+				break;
+
+			default:
+				if (!m_failed)
+				{
+					const char *sqlState = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+
+					m_failed = true;
+					m_rc = status;
+					m_rows = -1;
+					m_sqlState = sqlState ? sqlState : "";
+					m_dbconn->m_lastError = PQresultErrorMessage(res);
+					LOG_MESSAGE("Query error: " + m_dbconn->m_lastError, LOG_WARNING);
+				}
+				break;
+		}
+	}
+
+	// If the connection is 'broken', it is closed, as it can't tell where
+	// the query is at any more.
+	void Fail(const std::string &error, bool broken)
+	{
+		if (!m_failed)
+		{
+			m_failed = true;
+			m_rc = PGRES_FATAL_ERROR;
+			m_rows = -1;
+			m_dbconn->m_lastError = error;
+			LOG_MESSAGE("Query error: " + error, LOG_WARNING);
+		}
+
+		if (broken)
+		{
+			PQfinish(m_dbconn->m_conn);
+			m_dbconn->m_conn = NULL;
+		}
+
+		Finish();
+	}
+
+	void Finish()
+	{
+		bool cancelled = (m_watchdog && m_watchdog->Stop());
+
+		// The query may have completed before the cancel request got there
+		bool timedOut = cancelled && m_failed && m_sqlState == "57014";
+
+		// A cancel request may still reach the server late, and abort
+		// whatever runs next on the connection: it is closed rather than
+		// going back to the pool.
+		if (cancelled && m_dbconn->m_conn)
+		{
+			PQfinish(m_dbconn->m_conn);
+			m_dbconn->m_conn = NULL;
+		}
+		else if (m_dbconn->m_conn)
+			PQsetnonblocking(m_dbconn->m_conn, 0);
+
+		m_dbconn->SetLastResult(m_rc);
+		m_handler(m_rows, m_returned, timedOut);
+	}
+
+	DBconn                         *m_dbconn;
+	DBconn::StreamedHandler         m_handler;
+	std::shared_ptr<QueryWatchdog>  m_watchdog;
+	long long                       m_returned;
+	int                             m_rows;
+	int                             m_rc;
+	std::string                     m_sqlState;
+	bool                            m_failed;
+	bool                            m_copyOut;
+};
+
+
+// Start running the query with a StreamedQuery. 'handler' gets what
+// ExecuteVoid() would return, the number of rows returned, and whether the
+// query has been cancelled after 'timeout' milliseconds (0 for no limit).
+// Once a cancel request has been sent, the connection is closed, whether it
+// cancelled the query or came too late.
+// It is called from the event loop, unless the query could not even be sent.
+// The connection must not be used, nor returned, until then.
+void DBconn::ExecuteAsync(
+	const char *query, long timeout, const StreamedHandler &handler
+)
+{
+	std::shared_ptr<StreamedQuery> self(new StreamedQuery(this, handler));
+
+	StreamedQuery::Start(self, query, timeout);
+}
+
+
+DBresult *DBconn::Execute(const DBstatement &stmt, const DBparams &params)
+{
+	DBresult *res = new DBresult(this, stmt, params);
+
+	if (!res->IsValid())
+	{
+		delete res;
+		return 0;
+	}
+	return res;
+}
+
+
+int DBconn::ExecuteVoid(const DBstatement &stmt, const DBparams &params)
+{
+	int rows = -1;
+	DBresultPtr res = Execute(stmt, params);
+
+	if (res)
+	{
+		rows = res->RowsAffected();
+	}
+
+	return rows;
+}
+
+
+// Prepare the statement on this connection, unless that has been done
+// already. The server works out the types of the parameters.
+bool DBconn::Prepare(const DBstatement &stmt)
+{
+	if (m_prepared.find(stmt.name) != m_prepared.end())
+		return true;
+
+	PGresult *res = PQprepare(m_conn, stmt.name, stmt.query, 0, NULL);
+	int       rc = res ? PQresultStatus(res) : PGRES_FATAL_ERROR;
+
+	if (res)
+		PQclear(res);
+
+	if (rc != PGRES_COMMAND_OK)
+	{
+		SetLastResult(rc);
+		m_lastError = PQerrorMessage(m_conn);
+		LOG_MESSAGE(
+			std::string("Failed to prepare statement ") + stmt.name + ": " +
+			m_lastError, LOG_WARNING
+		);
+		return false;
+	}
+
+	m_prepared.insert(stmt.name);
+	return true;
+}
+
+
+// Tells whether the statement failed because it has to be prepared again:
+// it may have gone from the connection, e.g. after a step ran DISCARD ALL on
+// it, or its plan may not be usable any more, if the table it reads has
+// changed. It is then forgotten, so that the next run prepares it. A stale
+// statement is deallocated right away, or, if 'staleNames' is given (e.g. in
+// pipeline mode, where nothing else can be run), its name is added to it, to
+// be deallocated by the caller.
+bool DBconn::Forget(
+	const DBstatement &stmt, PGresult *result, std::vector<std::string> *staleNames
+)
+{
+	const char *state = result ? PQresultErrorField(result, PG_DIAG_SQLSTATE) : NULL;
+	bool        missing = (state != NULL && strcmp(state, "26000") == 0);
+	bool        isStale = (state != NULL && strcmp(state, "0A000") == 0);
+
+	if (!missing && !isStale)
+		return false;
+
+	m_prepared.erase(stmt.name);
+	if (isStale && staleNames != NULL)
+		staleNames->push_back(stmt.name);
+	else if (isStale)
+		PQclear(PQexec(m_conn, (std::string("DEALLOCATE ") + stmt.name).c_str()));
+
+	return true;
+}
+
+
+// Wait up to 'timeout' milliseconds for a notification on any channel this
+// connection is listening on. Returns 1 when woken up by a notification, 0 on
+// timeout, and -1 if the connection has been lost. The payloads of all the
+// pending notifications are appended to 'payloads' if given.
+int DBconn::WaitForNotification(
+	long timeout, std::vector<std::string> *payloads
+)
+{
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	bool notified = false;
+
+	do
+	{
+		// Notifications may already have arrived along with the results of
+		// the previous queries, so check before going to sleep.
+		if (!PQconsumeInput(m_conn))
+		{
+			m_lastError = PQerrorMessage(m_conn);
+			return -1;
+		}
+
+		PGnotify *notify;
+		while ((notify = PQnotifies(m_conn)) != NULL)
+		{
+			notified = true;
+			if (payloads != NULL)
+				payloads->push_back(notify->extra);
+			PQfreemem(notify);
+		}
+
+		if (notified)
+			return 1;
+
+		long remaining = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+			deadline - std::chrono::steady_clock::now()
+		).count();
+
+		if (remaining <= 0)
+			return 0;
+
+		int sock = PQsocket(m_conn);
+		int rc;
+
+		if (sock < 0)
+		{
+			m_lastError = "Invalid socket for the connection";
+			return -1;
+		}
+
+#if BOOST_OS_WINDOWS
+		// Wake up every second, so that the service can be paused.
+		CheckForInterrupt();
+		if (remaining > 1000)
+			remaining = 1000;
+
+		fd_set         input_mask;
+		struct timeval tv;
+
+		FD_ZERO(&input_mask);
+		FD_SET(sock, &input_mask);
+		tv.tv_sec = remaining / 1000;
+		tv.tv_usec = (remaining % 1000) * 1000;
+
+		rc = select(sock + 1, &input_mask, NULL, NULL, &tv);
+#else
+		struct pollfd pfd;
+
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		rc = poll(&pfd, 1, (int)remaining);
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+#endif
+
+		if (rc < 0)
+		{
+			m_lastError = (boost::format(
+				"Failed to wait for notifications, errno = %d") % errno
+			).str();
+			return -1;
+		}
+	} while (true);
+}
+
+
 std::string DBconn::GetLastError()
 {
 	boost::algorithm::trim(m_lastError);
@@ -362,23 +1296,77 @@ std::string DBconn::GetLastError()
 
 ///////////////////////////////////////////////////////7
 
-DBresult::DBresult(DBconn *conn, const std::string &query)
+DBresult::DBresult(DBconn *conn, const char *query)
 {
 	m_currentRow = 0;
 	m_maxRows = 0;
 
-	m_result = PQexec(conn->m_conn, query.c_str());
+	SetResult(conn, PQexec(conn->m_conn, query));
+}
+
+
+DBresult::DBresult(DBconn *conn, const DBstatement &stmt, const DBparams &params)
+{
+	std::vector<const char *> values(params.size());
+	PGresult *result = nullptr;
+
+	m_currentRow = 0;
+	m_maxRows = 0;
+	m_result = nullptr;
+
+	for (size_t i = 0; i < params.size(); i++)
+		values[i] = params[i].c_str();
+
+	// A statement which has to be prepared again is retried once.
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		if (!conn->Prepare(stmt))
+			return;
+
+		result = PQexecPrepared(
+			conn->m_conn, stmt.name, (int)values.size(),
+			values.empty() ? NULL : &values[0], NULL, NULL, 0
+		);
+
+		if (attempt > 0 || !conn->Forget(stmt, result))
+			break;
+
+		PQclear(result);
+		result = nullptr;
+	}
+
+	SetResult(conn, result);
+}
+
+
+DBresult::DBresult(DBconn *conn, PGresult *result)
+{
+	m_currentRow = 0;
+	m_maxRows = 0;
+
+	SetResult(conn, result);
+}
+
+
+void DBresult::SetResult(DBconn *conn, PGresult *result)
+{
+	m_result = result;
 
 	if (m_result != nullptr)
 	{
 		int rc = PQresultStatus(m_result);
 		conn->SetLastResult(rc);
 		if (rc == PGRES_TUPLES_OK)
+		{
 			m_maxRows = PQntuples(m_result);
+
+			for (int col = PQnfields(m_result) - 1; col >= 0; col--)
+				m_columns[PQfname(m_result, col)] = col;
+		}
 		else if (rc != PGRES_COMMAND_OK)
 		{
-			conn->m_lastError = PQerrorMessage(conn->m_conn);
-			LogMessage("Query error: " + conn->m_lastError, LOG_WARNING);
+			conn->m_lastError = PQresultErrorMessage(m_result);
+			LOG_MESSAGE("Query error: " + conn->m_lastError, LOG_WARNING);
 			PQclear(m_result);
 			m_result = nullptr;
 		}
@@ -400,31 +1388,231 @@ DBresult::~DBresult()
 
 std::string DBresult::GetString(int col) const
 {
-	std::string str;
+	return std::string(GetView(col));
+}
+
+
+std::string DBresult::GetString(const std::string &colname) const
+{
+	return GetString(ColumnIndex(colname));
+}
+
 
-	if (m_result && m_currentRow < m_maxRows && col >= 0)
+std::string_view DBresult::GetView(int col) const
+{
+	if (m_result && m_currentRow < m_maxRows && col >= 0 && col < PQnfields(m_result))
 	{
-		str = (const char *)PQgetvalue(m_result, m_currentRow, col);
+		return std::string_view(
+			PQgetvalue(m_result, m_currentRow, col),
+			PQgetlength(m_result, m_currentRow, col)
+		);
 	}
-	return str;
+	return std::string_view("", 0);
 }
 
 
-std::string DBresult::GetString(const std::string &colname) const
+std::string_view DBresult::GetView(const std::string &colname) const
+{
+	return GetView(ColumnIndex(colname));
+}
+
+
+bool DBresult::IsNull(int col) const
+{
+	if (m_result && m_currentRow < m_maxRows && col >= 0 && col < PQnfields(m_result))
+		return PQgetisnull(m_result, m_currentRow, col) != 0;
+
+	return true;
+}
+
+
+bool DBresult::IsNull(const std::string &colname) const
+{
+	return IsNull(ColumnIndex(colname));
+}
+
+
+long long DBresult::GetInt(int col, long long ifNull) const
+{
+	if (IsNull(col))
+		return ifNull;
+
+	return strtoll(PQgetvalue(m_result, m_currentRow, col), NULL, 10);
+}
+
+
+long long DBresult::GetInt(const std::string &colname, long long ifNull) const
+{
+	return GetInt(ColumnIndex(colname), ifNull);
+}
+
+
+bool DBresult::GetBool(int col, bool ifNull) const
 {
-	// Below function will return -1 if string is NULL or does not match.
-	int col = PQfnumber(m_result, colname.c_str());
+	if (IsNull(col))
+		return ifNull;
+
+	return PQgetvalue(m_result, m_currentRow, col)[0] == 't';
+}
+
 
-	if (col < 0)
+bool DBresult::GetBool(const std::string &colname, bool ifNull) const
+{
+	return GetBool(ColumnIndex(colname), ifNull);
+}
+
+
+int DBresult::ColumnIndex(const std::string &colname) const
+{
+	std::unordered_map<std::string, int>::const_iterator it = m_columns.find(colname);
+
+	return it == m_columns.end() ? -1 : it->second;
+}
+
+
+DBpipeline::~DBpipeline()
+{
+	Clear();
+}
+
+
+void DBpipeline::Clear()
+{
+	for (size_t i = 0; i < m_results.size(); i++)
+		delete m_results[i];
+	m_results.clear();
+}
+
+
+void DBpipeline::Add(const DBstatement &stmt, const DBparams &params)
+{
+	m_statements.push_back(std::make_pair(&stmt, params));
+}
+
+
+// Send all the statements, and wait for their results. Returns true if every
+// one of them succeeded.
+bool DBpipeline::Run()
+{
+	// A statement which has to be prepared again is retried, along with the
+	// whole batch, once.
+	for (int attempt = 0; attempt < 2; attempt++)
 	{
-		// fatal: not found
-		return "";
+		bool retry = false;
+
+		Clear();
+
+		for (size_t i = 0; i < m_statements.size(); i++)
+		{
+			if (!m_conn->Prepare(*m_statements[i].first))
+				return false;
+		}
+
+#ifdef LIBPQ_HAS_PIPELINING
+		PGconn *conn = m_conn->m_conn;
+
+		// Deallocated once out of pipeline mode
+		std::vector<std::string> staleNames;
+
+		if (!PQenterPipelineMode(conn))
+		{
+			m_conn->m_lastError = PQerrorMessage(conn);
+			return false;
+		}
+
+		for (size_t i = 0; i < m_statements.size(); i++)
+		{
+			const DBparams           &params = m_statements[i].second;
+			std::vector<const char *> values(params.size());
+
+			for (size_t p = 0; p < params.size(); p++)
+				values[p] = params[p].c_str();
+
+			PQsendQueryPrepared(
+				conn, m_statements[i].first->name, (int)values.size(),
+				values.empty() ? NULL : &values[0], NULL, NULL, 0
+			);
+		}
+		PQpipelineSync(conn);
+
+		for (size_t i = 0; i < m_statements.size(); i++)
+		{
+			PGresult *result = PQgetResult(conn);
+
+			// Each statement's result is followed by a NULL
+			if (result != NULL)
+				PQclear(PQgetResult(conn));
+
+			if (result != NULL && PQresultStatus(result) == PGRES_PIPELINE_ABORTED)
+			{
+				PQclear(result);
+				result = NULL;
+			}
+			else if (attempt == 0 && !retry && result != NULL)
+				retry = m_conn->Forget(*m_statements[i].first, result, &staleNames);
+
+			DBresult *res = (result ? new DBresult(m_conn, result) : NULL);
+
+			// A failed statement fails the batch, like an aborted one
+			if (res && !res->IsValid())
+			{
+				delete res;
+				res = NULL;
+			}
+			m_results.push_back(res);
+		}
+
+		// Wait for the end of the batch
+		PGresult *result;
+
+		while ((result = PQgetResult(conn)) != NULL)
+		{
+			bool synced = (PQresultStatus(result) == PGRES_PIPELINE_SYNC);
+
+			PQclear(result);
+			if (synced)
+				break;
+		}
+		PQexitPipelineMode(conn);
+
+		for (size_t i = 0; i < staleNames.size(); i++)
+			PQclear(PQexec(conn, ("DEALLOCATE " + staleNames[i]).c_str()));
+#else
+		// Without pipelining, the statements are run one after the other, and
+		// the batch stops at the first failure.
+		for (size_t i = 0; i < m_statements.size(); i++)
+		{
+			DBresult *res = NULL;
+
+			if (i == 0 || m_results.back() != NULL)
+				res = m_conn->Execute(*m_statements[i].first, m_statements[i].second);
+
+			m_results.push_back(res);
+		}
+#endif
+
+		if (!retry)
+			break;
 	}
 
-	return GetString(col);
+	for (size_t i = 0; i < m_results.size(); i++)
+	{
+		if (m_results[i] == NULL)
+			return false;
+	}
+
+	return true;
 }
 
 
+int DBpipeline::RowsAffected(size_t i) const
+{
+	if (i >= m_results.size() || m_results[i] == NULL)
+		return -1;
+
+	return (int)m_results[i]->RowsAffected();
+}
+
 
 const std::string CONNinfo::Parse(
 	const std::string& connStr, std::string *error,
@@ -467,7 +1655,7 @@ const std::string CONNinfo::Parse(
 	std::string val;
 	bool        atleastOneParameter = false;
 
-	LogMessage("Parsing connection information...", LOG_DEBUG);
+	LOG_MESSAGE("Parsing connection information...", LOG_DEBUG);
 
 	// Iterate over all options
 	for (opt = opts; opt->keyword; opt++)
@@ -481,7 +1669,7 @@ const std::string CONNinfo::Parse(
 		val = opt->val;
 		if (forLogging)
 		{
-			LogMessage((
+			LOG_MESSAGE((
 				boost::format("%s: %s") % opt->keyword %
 				(opt->dispchar[0] == '*' ? "*****" : val)).str(), LOG_DEBUG
 			);
@@ -0,0 +1,176 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// pgAgent - PostgreSQL Tools
+//
+// Copyright (C) 2002 - 2024, The pgAdmin Development Team
+// This software is released under the PostgreSQL Licence
+//
+// eventloop.cpp - thread running the asynchronous I/O and timers
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pgAgent.h"
+
+#include <unordered_map>
+
+#if !BOOST_OS_WINDOWS
+#include <unistd.h>
+#endif
+
+// The sockets belong to libpq, so the loop waits on a duplicate of each of
+// them, which it can close once done without closing the connection.
+#if BOOST_OS_WINDOWS
+typedef boost::asio::ip::tcp::socket           Waitable;
+#else
+typedef boost::asio::posix::stream_descriptor  Waitable;
+#endif
+
+// The pending socket waits; only used from the loop thread.
+static std::unordered_map<int, std::shared_ptr<Waitable> >  s_waits;
+
+static EventLoop *s_loop = NULL;
+static boost::mutex s_loopLock;
+
+
+EventLoop &EventLoop::Get()
+{
+	MutexLocker locker(&s_loopLock);
+
+	// Never deleted, as handlers may still be pending at exit
+	if (s_loop == NULL)
+		s_loop = new EventLoop();
+
+	return *s_loop;
+}
+
+
+EventLoop::EventLoop()
+	: m_work(boost::asio::make_work_guard(m_io))
+{
+	m_thread = new boost::thread(&EventLoop::Run, this);
+}
+
+
+void EventLoop::Run()
+{
+	while (true)
+	{
+		try
+		{
+			m_io.run();
+			return;
+		}
+		catch (std::exception &e)
+		{
+			LOG_MESSAGE(std::string("Unexpected error in the event loop: ") + e.what(), LOG_WARNING);
+		}
+	}
+}
+
+
+void EventLoop::Post(const Handler &handler)
+{
+	boost::asio::post(m_io, handler);
+}
+
+
+EventLoop::Timer EventLoop::After(
+	const std::chrono::milliseconds &delay, const Handler &handler
+)
+{
+	Timer timer(new boost::asio::steady_timer(m_io));
+
+	Post([timer, delay, handler]()
+	{
+		timer->expires_after(delay);
+		timer->async_wait([handler](const boost::system::error_code &ec)
+		{
+			if (!ec)
+				handler();
+		});
+	});
+
+	return timer;
+}
+
+
+void EventLoop::Cancel(const Timer &timer)
+{
+	if (timer)
+		Post([timer]() { timer->cancel(); });
+}
+
+
+void EventLoop::WaitSocket(int sock, bool forWrite, const WaitHandler &handler)
+{
+	Post([this, sock, forWrite, handler]()
+	{
+		std::shared_ptr<Waitable> waitable(new Waitable(m_io));
+		boost::system::error_code ec;
+
+#if BOOST_OS_WINDOWS
+		WSAPROTOCOL_INFOW info;
+		SOCKET dup = INVALID_SOCKET;
+
+		if (WSADuplicateSocketW((SOCKET)sock, GetCurrentProcessId(), &info) == 0)
+			dup = WSASocketW(
+				FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO,
+				&info, 0, WSA_FLAG_OVERLAPPED
+			);
+
+		if (dup == INVALID_SOCKET)
+		{
+			handler(false);
+			return;
+		}
+		waitable->assign(boost::asio::ip::tcp::v4(), dup, ec);
+#else
+		int dup = ::dup(sock);
+
+		if (dup < 0)
+		{
+			handler(false);
+			return;
+		}
+		waitable->assign(dup, ec);
+#endif
+
+		if (ec)
+		{
+			handler(false);
+			return;
+		}
+
+		s_waits[sock] = waitable;
+
+		waitable->async_wait(
+			forWrite ? Waitable::wait_write : Waitable::wait_read,
+			[sock, waitable, handler](const boost::system::error_code &ec)
+			{
+				std::unordered_map<int, std::shared_ptr<Waitable> >::iterator it =
+					s_waits.find(sock);
+
+				if (it != s_waits.end() && it->second == waitable)
+					s_waits.erase(it);
+
+				handler(!ec);
+			}
+		);
+	});
+}
+
+
+void EventLoop::CancelWait(int sock)
+{
+	Post([sock]()
+	{
+		std::unordered_map<int, std::shared_ptr<Waitable> >::iterator it =
+			s_waits.find(sock);
+
+		if (it != s_waits.end())
+		{
+			boost::system::error_code ec;
+			it->second->cancel(ec);
+		}
+	});
+}
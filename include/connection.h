@@ -13,9 +13,36 @@
 #ifndef CONNECTION_H
 #define CONNECTION_H
 
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <set>
+#include <string_view>
+#include <unordered_map>
 #include <libpq-fe.h>
 
 class DBresult;
+class ConnectState;
+
+// A statement the agent runs again and again. It is prepared under its name,
+// once on each connection, the first time it is executed there, and its
+// parameters ($1, $2, ...) are bound to the values given, in text form.
+struct DBstatement
+{
+	const char  *name;
+	const char  *query;
+};
+
+typedef std::vector<std::string> DBparams;
+
+// A database the connection pool should keep idle connections to
+struct PoolTarget
+{
+	std::string  connStr;
+	std::string  db;
+	long         count;
+};
 
 class CONNinfo
 {
@@ -39,23 +66,38 @@ private:
 
 class DBconn
 {
+public:
+	typedef std::function<void(int rows, long long returned, bool timedOut)> StreamedHandler;
+	typedef std::function<void(bool ok)> ConnectHandler;
+
 protected:
-	DBconn(const std::string& connStr);
+	DBconn(const std::string& connStr, bool connect = true);
 	~DBconn();
 
 public:
 	static DBconn     *Get(const std::string &connStr="", const std::string &db="");
 	static DBconn     *InitConnection(const std::string &connectString);
 	static void        ClearConnections(bool allIncludingPrimary = false);
+	static void        MaintainPool();
+	static void        Prewarm(const std::vector<PoolTarget> &targets);
 
-	std::string        qtDbString(const std::string &value);
+	std::future<bool>  ConnectAsync();
+	void               ConnectAsync(const ConnectHandler &done);
 
 	bool               BackendMinimumVersion(int major, int minor);
 	std::string        GetLastError();
 	operator           bool() const { return m_conn != NULL; }
 	DBresult          *Execute(const std::string &query);
+	DBresult          *Execute(const char *query);
 	std::string        ExecuteScalar(const std::string &query);
 	int                ExecuteVoid(const std::string &query);
+	int                ExecuteVoid(const char *query);
+	void               ExecuteAsync(
+		const char *query, long timeout, const StreamedHandler &handler);
+	DBresult          *Execute(const DBstatement &stmt, const DBparams &params);
+	int                ExecuteVoid(const DBstatement &stmt, const DBparams &params);
+	int                WaitForNotification(
+		long timeout, std::vector<std::string> *payloads = NULL);
 	void               Return();
 
 	const std::string &DebugConnectionStr() const;
@@ -93,7 +135,19 @@ public:
 	}
 
 private:
-	bool Connect(const std::string &connectString);
+	bool Connect();
+	void StartConnect(std::shared_ptr<ConnectState> state);
+	bool Prepare(const DBstatement &stmt);
+	bool Forget(
+		const DBstatement &stmt, PGresult *result,
+		std::vector<std::string> *staleNames = NULL
+	);
+	bool IsReusable(const std::chrono::steady_clock::time_point &now) const;
+
+	static bool PoolKey(
+		const std::string &connStr, const std::string &db,
+		std::string &key, size_t &shard
+	);
 
 	int  m_minorVersion,
        m_majorVersion;
@@ -106,14 +160,20 @@ protected:
 	std::string      m_connStr;
 
 	PGconn          *m_conn;
-	DBconn          *m_next;
-	DBconn          *m_prev;
 
 	bool             m_remoteDatabase;
 	bool             m_inUse;
+	size_t           m_shard;
+	std::chrono::steady_clock::time_point m_created, m_lastUsed;
 	int              m_lastResult;
 
+	// Names of the statements prepared on this connection so far
+	std::set<std::string> m_prepared;
+
 	friend class DBresult;
+	friend class DBpipeline;
+	friend class ConnectState;
+	friend class StreamedQuery;
 
 };
 
@@ -121,7 +181,11 @@ protected:
 class DBresult
 {
 protected:
-	DBresult(DBconn *conn, const std::string &query);
+	DBresult(DBconn *conn, const char *query);
+	DBresult(DBconn *conn, const DBstatement &stmt, const DBparams &params);
+	DBresult(DBconn *conn, PGresult *result);
+
+	void        SetResult(DBconn *conn, PGresult *result);
 
 public:
 	~DBresult();
@@ -129,6 +193,22 @@ public:
 	std::string GetString(int col) const;
 	std::string GetString(const std::string &colname) const;
 
+	// The value points into the result, and stays valid for as long as the
+	// result; it is always followed by a '\0'.
+	std::string_view GetView(int col) const;
+	std::string_view GetView(const std::string &colname) const;
+
+	// Typed values; NULL, or a column which doesn't exist, gives 'ifNull'
+	bool        IsNull(int col) const;
+	bool        IsNull(const std::string &colname) const;
+	long long   GetInt(int col, long long ifNull = 0) const;
+	long long   GetInt(const std::string &colname, long long ifNull = 0) const;
+	bool        GetBool(int col, bool ifNull = false) const;
+	bool        GetBool(const std::string &colname, bool ifNull = false) const;
+
+	// Index of the named column, or -1
+	int         ColumnIndex(const std::string &colname) const;
+
 	bool        IsValid() const
 	{
 		return m_result != NULL;
@@ -141,6 +221,10 @@ public:
 	{
 		if (m_currentRow < m_maxRows) m_currentRow++;
 	}
+	void        MoveFirst()
+	{
+		m_currentRow = 0;
+	}
 
 	long        RowsAffected() const
 	{
@@ -151,7 +235,37 @@ protected:
 	PGresult *m_result;
 	int       m_currentRow, m_maxRows;
 
+	// Column indexes by name, looked up once per result
+	std::unordered_map<std::string, int> m_columns;
+
 	friend class DBconn;
+	friend class DBpipeline;
+};
+
+
+// A batch of statements sent to the server all at once, in pipeline mode, so
+// that they take a single round trip. They run in one implicit transaction:
+// if any of them fails, none of them has any effect. Without pipelining in
+// libpq, they are run one at a time instead, until the first failure.
+class DBpipeline
+{
+public:
+	DBpipeline(DBconn *conn) : m_conn(conn) {}
+	~DBpipeline();
+
+	void        Add(const DBstatement &stmt, const DBparams &params);
+	bool        Run();
+
+	size_t      Size() const { return m_statements.size(); }
+	DBresult   *Result(size_t i) { return i < m_results.size() ? m_results[i] : NULL; }
+	int         RowsAffected(size_t i) const;
+
+private:
+	void        Clear();
+
+	DBconn                  *m_conn;
+	std::vector<std::pair<const DBstatement *, DBparams> > m_statements;
+	std::vector<DBresult *>  m_results;
 };
 
 
@@ -0,0 +1,59 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// pgAgent - PostgreSQL Tools
+//
+// Copyright (C) 2002 - 2024, The pgAdmin Development Team
+// This software is released under the PostgreSQL Licence
+//
+// eventloop.h - thread running the asynchronous I/O and timers
+//
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+
+// Waits for the sockets and timers of the asynchronous operations of the
+// agent (e.g. opening connections), in a thread of its own. The handlers are
+// all called from that thread, one at a time, so they need no locking between
+// themselves; they must not block.
+class EventLoop
+{
+public:
+	typedef std::function<void()>                       Handler;
+	typedef std::function<void(bool ready)>             WaitHandler;
+	typedef std::shared_ptr<boost::asio::steady_timer>  Timer;
+
+	// The loop is started on first use, and runs until the process exits
+	static EventLoop &Get();
+
+	// Calls 'handler' from the loop
+	void  Post(const Handler &handler);
+
+	// Calls 'handler' after 'delay', unless the timer is cancelled first
+	Timer After(const std::chrono::milliseconds &delay, const Handler &handler);
+	void  Cancel(const Timer &timer);
+
+	// Calls 'handler' once 'sock' is ready for reading (or writing, if
+	// 'forWrite' is set), with false if it could not be waited for, or the
+	// wait has been cancelled. There can only be one wait per socket.
+	void  WaitSocket(int sock, bool forWrite, const WaitHandler &handler);
+	void  CancelWait(int sock);
+
+private:
+	EventLoop();
+	void Run();
+
+	boost::asio::io_context  m_io;
+	boost::asio::executor_work_guard<boost::asio::io_context::executor_type>  m_work;
+	boost::thread           *m_thread;
+};
+
+#endif // EVENTLOOP_H
@@ -13,35 +13,65 @@
 #ifndef JOB_H
 #define JOB_H
 
+#include <chrono>
+#include <functional>
+#include <memory>
+
 #include <boost/thread.hpp>
 
-class Job
+class WorkerPool;
+
+// A job being run. It is only ever handled by one thread at a time, but not
+// always the same one: a worker runs it until it starts an SQL step, and the
+// end of that step hands it to whichever worker is free then.
+class Job : public std::enable_shared_from_this<Job>
 {
 public:
-	Job(DBconn *conn, const std::string &jid);
+	typedef std::function<void()> DoneHandler;
+
 	~Job();
 
-	int Execute();
-	bool Runnable()
-	{
-		return m_status == "r";
-	}
+	static bool Start(
+		DBconn *conn, const std::string &jobid, const std::string &logid,
+		WorkerPool *pool, const DoneHandler &done
+	);
+
+	static int Finish(
+		DBconn *conn, const std::string &jobid, const std::string &logid,
+		const std::string &status, const DBparams &stepEnd = DBparams()
+	);
 
 protected:
-	DBconn      *m_threadConn;
-	std::string  m_jobid, m_logid;
-	std::string  m_status;
-};
+	Job(
+		DBconn *conn, const std::string &jid, const std::string &lid,
+		WorkerPool *pool, const DoneHandler &done,
+		const std::chrono::steady_clock::time_point &submitted
+	);
 
-class JobThread
-{
-public:
-	JobThread(const std::string &jid);
-	~JobThread();
-	void operator()();
+	void Run();
+	bool LoadSteps();
+	bool BeginStep();
+	bool EndStep(int rc, bool succeeded, const std::string &output, bool timedOut);
+	void RunSqlStep(DBconn *stepConn);
+	void SqlStepDone(
+		DBconn *stepConn, long timeout, int rc, long long returned, bool timedOut
+	);
+
+	DBconn                    *m_threadConn;
+	WorkerPool                *m_pool;
+	DoneHandler                m_done;
+	std::string                m_jobid, m_logid;
+	std::string                m_status;
+	std::unique_ptr<DBresult>  m_steps;
+	std::string                m_jslid;
+
+	// The end of the last step run, not recorded yet
+	DBparams                   m_stepEnd;
 
-private:
-	std::string  m_jobid;
+	// What the job is doing, for the log; set as the context of whichever
+	// thread runs the job
+	LogContext                 m_logContext;
+	std::chrono::steady_clock::time_point  m_started;
 };
 
 #endif // JOB_H
@@ -0,0 +1,136 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// pgAgent - PostgreSQL Tools
+//
+// Copyright (C) 2002 - 2024, The pgAdmin Development Team
+// This software is released under the PostgreSQL Licence
+//
+// logger.h - log file written by a thread of its own
+//
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+// What a thread is doing on behalf of a job, added to the messages it logs
+// in the JSON format. 'since' is the start of the current phase.
+struct LogContext
+{
+	std::string  jobid, logid, stepid;
+	const char  *phase;
+	std::chrono::steady_clock::time_point since;
+};
+
+// Makes 'context' the one of the current thread, until the scope ends. It is
+// not copied: changes made to it meanwhile show in the messages.
+class LogScope
+{
+public:
+	LogScope(const LogContext &context);
+	~LogScope();
+
+	// The context of the current thread, or NULL
+	static const LogContext *Current();
+
+private:
+	const LogContext  *m_previous;
+};
+
+#if !BOOST_OS_WINDOWS
+
+// The messages are formatted by the threads logging them, as text or, if
+// 'logFormat' is "json", as JSON objects, one per line, and queued in a
+// bounded ring buffer, which they add to without taking any lock. A thread
+// of its own takes them from there, and writes them to the log file (or to
+// the standard output) in batches, so that no thread but that one ever waits
+// for the disk.
+//
+// The log file is rotated once it has grown beyond 'logRotateSize' MB, or
+// has been written to for 'logRotateAge' seconds, and can be reopened on
+// request, e.g. after logrotate has moved it.
+//
+// When the buffer is full, the message is dropped (and the number of the
+// dropped messages logged later on) or, if 'logWhenFull' is "wait", or the
+// message must not be lost, the thread waits for room in the buffer.
+class Logger
+{
+public:
+	// The writer thread is started on first use
+	static Logger &Get();
+
+	void Write(int level, const std::string &msg, bool mustWait = false);
+
+	// Waits for all the messages queued so far to be written
+	void Flush();
+
+	// Writes all the messages, and stops the writer thread, e.g. before
+	// forking; it is started again by the next message.
+	void Stop();
+
+	// Has the log file opened again before the next batch; safe to call from
+	// a signal handler
+	static void RequestReopen();
+
+private:
+	Logger(size_t size);
+
+	struct Cell
+	{
+		std::atomic<size_t>  seq;
+		std::string          msg;
+	};
+
+	bool Push(std::string &msg);
+	bool Pop(std::string &msg);
+	bool IsEmpty() const;
+
+	void Start();
+	void Run();
+	void Wake();
+	void WriteOut(const std::string &batch);
+	void CloseFile();
+	bool IsRotationDue(size_t bytes) const;
+	void Rotate();
+	void PruneRotated();
+#ifdef HAVE_ZLIB
+	static void Compress(const std::string &file);
+#endif
+
+	// The ring buffer; m_head is only used by the writer thread
+	std::vector<Cell>    m_cells;
+	size_t               m_mask;
+	std::atomic<size_t>  m_tail;
+	size_t               m_head;
+
+	std::atomic<bool>    m_running;
+	std::atomic<bool>    m_sleeping;
+	std::atomic<long>    m_dropped;
+
+	// Number of messages queued, and written
+	std::atomic<unsigned long long>  m_queued, m_written;
+
+	boost::mutex         m_lock;
+	boost::condition_variable  m_wake, m_flushed;
+	boost::thread       *m_thread;
+	bool                 m_stop;
+	int                  m_fd;
+	bool                 m_openFailed;
+
+	// Size of the log file, and when it was opened, for its rotation
+	long long            m_size;
+	time_t               m_opened;
+};
+
+#endif // !BOOST_OS_WINDOWS
+
+#endif // LOGGER_H
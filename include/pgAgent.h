@@ -34,10 +34,25 @@
 
 #include "misc.h"
 #include "connection.h"
+#include "logger.h"
 #include "job.h"
+#include "process.h"
+#include "timerqueue.h"
+#include "workerpool.h"
+#include "eventloop.h"
 
 extern long        longWait;
 extern long        shortWait;
+extern long        maxWait;
+extern long        workers;
+extern long        maxJobs;
+extern long        reservedWorkers;
+extern long        poolMinIdle;
+extern long        poolMaxIdle;
+extern long        poolIdleTimeout;
+extern long        poolMaxLifetime;
+extern long        poolPrewarm;
+extern long        connectTimeout;
 extern long        minLogLevel;
 extern std::string connectString;
 extern std::string backendPid;
@@ -45,6 +60,13 @@ extern std::string backendPid;
 #if !BOOST_OS_WINDOWS
 extern bool        runInForeground;
 extern std::string logFile;
+extern long        logBufferSize;
+extern std::string logWhenFull;
+extern std::string logFormat;
+extern long        logRotateSize;
+extern long        logRotateAge;
+extern long        logRotateKeep;
+extern long        logRotateCompress;
 #endif
 
 // Log levels
@@ -60,6 +82,17 @@ enum
 	LOG_STARTUP = 15
 };
 
+// Whether messages of the given level are logged at all
+inline bool LogEnabled(int level)
+{
+	return (level != LOG_DEBUG && level != LOG_WARNING) || minLogLevel >= level;
+}
+
+// Same as LogMessage(), but the message is only built when its level is
+// logged, e.g. LOG_MESSAGE("Starting job: " + jobid, LOG_DEBUG)
+#define LOG_MESSAGE(msg, level) \
+	do { if (LogEnabled(level)) LogMessage((msg), (level)); } while (0)
+
 // Prototypes
 void LogMessage(const std::string &msg, const int &level);
 void MainLoop();
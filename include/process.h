@@ -0,0 +1,71 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// pgAgent - PostgreSQL Tools
+//
+// Copyright (C) 2002 - 2024, The pgAdmin Development Team
+// This software is released under the PostgreSQL Licence
+//
+// process.h - child process running a batch step
+//
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#if !BOOST_OS_WINDOWS
+
+#include <string>
+#include <signal.h>
+#include <sys/types.h>
+
+// A script run in a process group of its own, with its standard output and
+// error read through pipes of their own. Nothing is shared with the agent or
+// the other children, so that any number of them can run at the same time.
+class ChildProcess
+{
+public:
+	ChildProcess();
+
+	// Kills the whole process group if it is still running
+	~ChildProcess();
+
+	// Starts the script, through the shell as popen() would
+	bool Start(const std::string &path);
+
+	// Reads both outputs until the script closes them, and waits for it to
+	// exit. If it runs for longer than 'timeout' ms (0 for no limit), its
+	// process group is killed, and TimedOut() is true.
+	bool Wait(long timeout = 0);
+
+	// Sends 'sig' to the whole process group
+	void Kill(int sig = SIGKILL);
+
+	const std::string &Output() const { return m_output; }
+	const std::string &Errors() const { return m_errors; }
+	const std::string &GetError() const { return m_error; }
+
+	// The exit status, or -1 if the script was ended by a signal
+	int  ExitCode() const;
+
+	// The signal which ended the script, or 0
+	int  TermSignal() const;
+
+	bool TimedOut() const { return m_timedOut; }
+
+private:
+	bool OpenPipe(int fds[2]);
+	void Reap();
+	void CloseFds();
+
+	pid_t        m_pid;
+	int          m_outFd, m_errFd;
+	int          m_status;
+	bool         m_timedOut;
+	std::string  m_output, m_errors;
+	std::string  m_error;
+};
+
+#endif // !BOOST_OS_WINDOWS
+
+#endif // PROCESS_H
@@ -0,0 +1,53 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// pgAgent - PostgreSQL Tools
+//
+// Copyright (C) 2002 - 2024, The pgAdmin Development Team
+// This software is released under the PostgreSQL Licence
+//
+// timerqueue.h - next run times of the jobs known to the agent
+//
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef TIMERQUEUE_H
+#define TIMERQUEUE_H
+
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+// A min-heap of (next run, job id) pairs, indexed by the job id, so that the
+// next run time of a single job can be changed or removed in O(log n).
+class TimerQueue
+{
+public:
+	typedef std::chrono::steady_clock::time_point time_point;
+
+	void        Set(const std::string &jobid, const time_point &due);
+	void        Remove(const std::string &jobid);
+	void        Clear();
+
+	// Removes the earliest job if it is due at 'now'
+	bool        PopDue(const time_point &now, std::string &jobid);
+
+	bool        Empty() const { return m_heap.empty(); }
+	size_t      Size() const { return m_heap.size(); }
+	time_point  NextDue() const { return m_heap.front().due; }
+
+private:
+	struct Entry
+	{
+		time_point   due;
+		std::string  jobid;
+	};
+
+	void Swap(size_t a, size_t b);
+	void SiftUp(size_t pos);
+	void SiftDown(size_t pos);
+
+	std::vector<Entry>                       m_heap;
+	std::unordered_map<std::string, size_t>  m_index;
+};
+
+#endif // TIMERQUEUE_H
@@ -0,0 +1,69 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// pgAgent - PostgreSQL Tools
+//
+// Copyright (C) 2002 - 2024, The pgAdmin Development Team
+// This software is released under the PostgreSQL Licence
+//
+// workerpool.h - fixed set of threads running the jobs
+//
+//////////////////////////////////////////////////////////////////////////
+
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+// A fixed number of worker threads, fed from a single queue, running up to
+// a fixed number of jobs at the same time.
+//
+// All the work comes from the dispatcher in the main thread, which only
+// claims as many jobs as Available() allows, so there is nothing for the
+// workers to steal from each other - one shared queue keeps it simple.
+//
+// A job takes one of the 'slots' until it releases it, which may be long
+// after the task which started it has returned: a job waiting for its SQL
+// step to finish doesn't hold a thread. There can be more slots than
+// threads, then.
+class WorkerPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	WorkerPool(size_t workers, size_t slots);
+	~WorkerPool();
+
+	// Queues the task starting a job; returns false if all the slots are
+	// already taken
+	bool        Submit(const Task &task);
+
+	// Queues a task going on with a job which holds a slot already
+	void        Resume(const Task &task);
+
+	// Gives back the slot of a job which is over
+	void        Release();
+
+	// Number of jobs which can be submitted
+	size_t      Available();
+
+	size_t      Size() const { return m_workers.size(); }
+
+private:
+	void        Run();
+
+	boost::mutex                  m_lock;
+	boost::condition_variable     m_cond;
+	std::deque<Task>              m_queue;
+	std::vector<boost::thread *>  m_workers;
+	size_t                        m_busy;
+	size_t                        m_slots, m_taken;
+	bool                          m_stopping;
+};
+
+#endif // WORKERPOOL_H
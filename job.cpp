@@ -15,150 +15,373 @@
 
 #if !BOOST_OS_WINDOWS
 #include <errno.h>
-#include <sys/wait.h>
 #include <sys/stat.h>
 #endif
 
-Job::Job(DBconn *conn, const std::string &jid)
+// The statements keeping the job and step logs, run on the agent's own
+// connections for every job and step. The work is done by the server-side
+// functions, so that each of them is a single call.
+static const DBstatement sqlJobSteps = {
+	"pga_job_steps",
+	"SELECT * FROM pgagent.pga_job_steps($1)"
+};
+
+static const DBstatement sqlStepStart = {
+	"pga_step_begin",
+	"SELECT pgagent.pga_step_begin($1, $2) AS jslid"
+};
+
+static const DBstatement sqlStepEnd = {
+	"pga_step_end",
+	"SELECT pgagent.pga_step_end($1, $2, $3, $4) AS found"
+};
+
+static const DBstatement sqlJobEnd = {
+	"pga_job_end",
+	"SELECT pgagent.pga_job_end($1, $2, $3) AS found"
+};
+
+
+Job::Job(
+	DBconn *conn, const std::string &jid, const std::string &lid,
+	WorkerPool *pool, const DoneHandler &done,
+	const std::chrono::steady_clock::time_point &submitted
+)
 {
 	m_threadConn = conn;
 	m_jobid = jid;
-	m_status = "";
+	m_logid = lid;
+	m_pool = pool;
+	m_done = done;
 
-	LogMessage("Starting job: " + m_jobid, LOG_DEBUG);
+	// The job has already been claimed, and its joblog entry created, by
+	// the main thread.
+	m_status = "r";
 
-	int rc = m_threadConn->ExecuteVoid(
-		"UPDATE pgagent.pga_job SET jobagentid=" + backendPid +
-		", joblastrun=now() WHERE jobagentid IS NULL AND jobid=" + m_jobid
-	);
+	// The time spent waiting for a worker shows in the first message
+	m_logContext.jobid = m_jobid;
+	m_logContext.logid = m_logid;
+	m_logContext.phase = "dispatch";
+	m_logContext.since = submitted;
 
-	if (rc == 1)
-	{
-		DBresultPtr id = m_threadConn->Execute(
-			"SELECT nextval('pgagent.pga_joblog_jlgid_seq') AS id"
-		);
-		if (id)
-		{
-			m_logid = id->GetString("id");
+	LogScope scope(m_logContext);
 
-			DBresultPtr res = m_threadConn->Execute(
-				"INSERT INTO pgagent.pga_joblog(jlgid, jlgjobid, jlgstatus) "
-				"VALUES (" + m_logid + ", " + m_jobid + ", 'r')");
-			if (res)
-			{
-				m_status = "r";
-			}
-		}
-	}
+	LOG_MESSAGE("Starting job: " + m_jobid, LOG_DEBUG);
+
+	m_started = std::chrono::steady_clock::now();
+	m_logContext.phase = "job";
+	m_logContext.since = m_started;
 }
 
 
 Job::~Job()
 {
+	LogScope scope(m_logContext);
+
+	m_logContext.stepid.clear();
+	m_logContext.phase = "finish";
+	m_logContext.since = m_started;
+
 	if (!m_status.empty())
+		Finish(m_threadConn, m_jobid, m_logid, m_status, m_stepEnd);
+	m_threadConn->Return();
+
+	LOG_MESSAGE("Completed job: " + m_jobid, LOG_DEBUG);
+
+	if (m_done)
+		m_done();
+}
+
+
+// Run the job on one of the workers. 'done' is called once it is over, which
+// may be long after the worker has gone on to something else, as the
+// workers don't wait for the SQL steps. Returns false if there is no room in
+// the pool for the job.
+bool Job::Start(
+	DBconn *conn, const std::string &jobid, const std::string &logid,
+	WorkerPool *pool, const DoneHandler &done
+)
+{
+	std::chrono::steady_clock::time_point submitted =
+		std::chrono::steady_clock::now();
+
+	return pool->Submit([conn, jobid, logid, pool, done, submitted]()
 	{
-		m_threadConn->ExecuteVoid(
-			"UPDATE pgagent.pga_joblog "
-			"   SET jlgstatus='" + m_status + "', jlgduration=now() - jlgstart " +
-			" WHERE jlgid=" + m_logid + ";\n" +
-
-			"UPDATE pgagent.pga_job " +
-			"   SET jobagentid=NULL, jobnextrun=NULL " +
-			" WHERE jobid=" + m_jobid
+		std::shared_ptr<Job> job(
+			new Job(conn, jobid, logid, pool, done, submitted)
 		);
-	}
-	m_threadConn->Return();
+		LogScope scope(job->m_logContext);
+
+		job->Run();
+	});
+}
+
 
-	LogMessage("Completed job: " + m_jobid, LOG_DEBUG);
+// Set the final status of the job log entry, and give the job back so that
+// its next run time gets computed, both at once. The end of the last step, if
+// given, is recorded in the same round trip. Returns 1 if the job log entry
+// was found.
+int Job::Finish(
+	DBconn *conn, const std::string &jobid, const std::string &logid,
+	const std::string &status, const DBparams &stepEnd
+)
+{
+	DBpipeline pipeline(conn);
+
+	if (!stepEnd.empty())
+		pipeline.Add(sqlStepEnd, stepEnd);
+	pipeline.Add(sqlJobEnd, {jobid, logid, status});
+
+	pipeline.Run();
+
+	DBresult *res = pipeline.Result(pipeline.Size() - 1);
+
+	return (res && res->GetBool("found")) ? 1 : 0;
 }
 
 
-int Job::Execute()
+// Read the steps to run, and open the connections they need.
+bool Job::LoadSteps()
 {
-	int rc = 0;
-	bool succeeded = false;
-	DBresultPtr steps = m_threadConn->Execute(
-		"SELECT * "
-		"  FROM pgagent.pga_jobstep "
-		" WHERE jstenabled "
-		"   AND jstjobid=" + m_jobid +
-		" ORDER BY jstname, jstid");
-
-	if (!steps)
+	m_steps.reset(m_threadConn->Execute(sqlJobSteps, {m_jobid}));
+
+	if (!m_steps)
 	{
-		LogMessage("No steps found for jobid " + m_jobid, LOG_WARNING);
+		LOG_MESSAGE("No steps found for jobid " + m_jobid, LOG_WARNING);
 		m_status = "i";
-		return -1;
+		return false;
 	}
 
-	while (steps->HasData())
+	// Start opening the connections for the SQL steps running against
+	// different databases all at once, rather than one step at a time. The
+	// workers don't wait for them: the pool gets them as they open. The first
+	// step connects on its own, as it needs its connection right away.
+	std::set<std::pair<std::string, std::string> > stepTargets;
+	std::pair<std::string, std::string>             firstTarget;
+
+	while (m_steps->HasData())
 	{
-		DBconn      *stepConn = nullptr;
-		std::string  jslid, stepid, jpecode, output;
+		if (m_steps->GetView("jstkind") == "s")
+		{
+			std::pair<std::string, std::string> target(
+				m_steps->GetString("jstconnstr"), m_steps->GetString("jstdbname")
+			);
 
-		stepid = steps->GetString("jstid");
+			if (stepTargets.empty())
+				firstTarget = target;
+			stepTargets.insert(target);
+		}
+		m_steps->MoveNext();
+	}
+	m_steps->MoveFirst();
 
-		DBresultPtr id = m_threadConn->Execute(
-			"SELECT nextval('pgagent.pga_jobsteplog_jslid_seq') AS id"
-		);
+	if (stepTargets.size() > 1)
+	{
+		std::vector<PoolTarget> targets;
 
-		if (id)
+		for (auto it = stepTargets.begin(); it != stepTargets.end(); ++it)
 		{
-			jslid = id->GetString("id");
-			DBresultPtr res = m_threadConn->Execute(
-				"INSERT INTO pgagent.pga_jobsteplog(jslid, jsljlgid, jsljstid, jslstatus) "
-				"SELECT " + jslid + ", " + m_logid + ", " + stepid + ", 'r'" +
-				"  FROM pgagent.pga_jobstep WHERE jstid=" + stepid);
+			if (*it == firstTarget)
+				continue;
 
-			if (res)
-			{
-				rc = res->RowsAffected();
-				LogMessage("Number of rows affected for jobid " + m_jobid, LOG_DEBUG);
-			}
-			else
-				rc = -1;
+			PoolTarget target = { it->first, it->second, 1 };
+			targets.push_back(target);
 		}
 
-		if (rc != 1)
+		DBconn::Prewarm(targets);
+	}
+
+	return true;
+}
+
+
+// Create the log entry of the current step. The end of the previous step is
+// recorded in the same round trip.
+bool Job::BeginStep()
+{
+	DBpipeline start(m_threadConn);
+	bool       ended = m_stepEnd.empty();
+	int        rc;
+
+	m_logContext.stepid = m_steps->GetString("jstid");
+	m_logContext.phase = "step";
+	m_logContext.since = std::chrono::steady_clock::now();
+
+	if (!ended)
+		start.Add(sqlStepEnd, m_stepEnd);
+	start.Add(sqlStepStart, {m_logid, m_steps->GetString("jstid")});
+
+	start.Run();
+	m_stepEnd.clear();
+
+	DBresult *res = start.Result(start.Size() - 1);
+
+	if (res)
+	{
+		// NULL if the step has been removed in the meantime
+		m_jslid = res->GetString("jslid");
+		rc = m_jslid.empty() ? 0 : 1;
+		LOG_MESSAGE("Number of rows affected for jobid " + m_jobid, LOG_DEBUG);
+	}
+	else
+		rc = -1;
+
+	if (!ended && !(start.Result(0) && start.Result(0)->GetBool("found")))
+	{
+		// The previous step could not be recorded: give up, and don't
+		// leave this one looking like it's running.
+		if (rc == 1)
+			m_stepEnd = {m_jslid, "-1", "d", ""};
+		m_status = "f";
+		return false;
+	}
+
+	if (rc != 1)
+	{
+		LOG_MESSAGE("Value of rc is " + std::to_string(rc) + " for job " + m_jobid, LOG_WARNING);
+		m_status = "i";
+		return false;
+	}
+
+	return true;
+}
+
+
+// Keep the outcome of the current step, to be recorded along with whatever
+// comes next. Returns false if the job must stop there.
+bool Job::EndStep(int rc, bool succeeded, const std::string &output, bool timedOut)
+{
+	// A step which timed out is logged as such, and otherwise handled like
+	// any other failure.
+	std::string onerror;
+	if (succeeded)
+		onerror = "s";
+	else
+		onerror = m_steps->GetString("jstonerror");
+
+	std::string stepstatus = (timedOut ? "t" : onerror);
+
+	m_stepEnd = {m_jslid, NumToStr(rc), stepstatus, output};
+
+	if (onerror == "f")
+	{
+		m_status = "f";
+		return false;
+	}
+
+	return true;
+}
+
+
+// Start the current step, an SQL one, without waiting for it: the worker is
+// free for other jobs meanwhile. Its completion, on the event loop, hands
+// the rest of the job back to the workers.
+void Job::RunSqlStep(DBconn *stepConn)
+{
+	std::shared_ptr<Job> self = shared_from_this();
+	long timeout = (long)m_steps->GetInt("timeout");
+
+	// Whatever the step returns is counted and discarded, not kept in memory.
+	stepConn->ExecuteAsync(
+		m_steps->GetView("jstcode").data(), timeout,
+		[self, stepConn, timeout](int rc, long long returned, bool timedOut) mutable
 		{
-			LogMessage("Value of rc is " + std::to_string(rc) + " for job " + m_jobid, LOG_WARNING);
-			m_status = "i";
-			return -1;
+			// The job must not end on the event loop, so the only reference
+			// left goes to the worker.
+			WorkerPool *pool = self->m_pool;
+
+			pool->Resume([job = std::move(self), stepConn, timeout, rc, returned, timedOut]()
+			{
+				LogScope scope(job->m_logContext);
+
+				job->SqlStepDone(stepConn, timeout, rc, returned, timedOut);
+			});
 		}
+	);
+}
+
+
+void Job::SqlStepDone(
+	DBconn *stepConn, long timeout, int rc, long long returned, bool timedOut
+)
+{
+	std::string stepid = m_steps->GetString("jstid");
+
+	LOG_MESSAGE(
+		"SQL step " + stepid + " returned " + std::to_string(returned) +
+		" rows", LOG_DEBUG
+	);
+
+	bool succeeded = stepConn->LastCommandOk();
+	std::string output = stepConn->GetLastError();
+	stepConn->Return();
+
+	if (timedOut)
+	{
+		succeeded = false;
+		output = (boost::format(
+			"Timed out after %.3f seconds\n%s"
+		) % (timeout / 1000.0) % output).str();
+		LOG_MESSAGE(
+			"SQL step " + stepid + " of job " + m_jobid + " timed out",
+			LOG_WARNING
+		);
+	}
+
+	if (!EndStep(rc, succeeded, output, timedOut))
+		return;
+
+	m_steps->MoveNext();
+	Run();
+}
+
+
+// Run the steps from the current one on, until they are all done, or one of
+// them has failed, or an SQL step has been started; the end of that one runs
+// the rest.
+void Job::Run()
+{
+	if (!m_steps && !LoadSteps())
+		return;
 
-		switch ((int)steps->GetString("jstkind")[0])
+	while (m_steps->HasData())
+	{
+		int          rc = 0;
+		bool         succeeded = false, timedOut = false;
+		std::string  stepid, output;
+
+		stepid = m_steps->GetString("jstid");
+
+		if (!BeginStep())
+			return;
+
+		switch ((int)m_steps->GetView("jstkind")[0])
 		{
 			case 's':
 			{
-				std::string jstdbname = steps->GetString("jstdbname");
-				std::string jstconnstr = steps->GetString("jstconnstr");
-
-				stepConn = DBconn::Get(jstconnstr, jstdbname);
+				std::string jstdbname = m_steps->GetString("jstdbname");
+				std::string jstconnstr = m_steps->GetString("jstconnstr");
+				DBconn     *stepConn = DBconn::Get(jstconnstr, jstdbname);
 
 				if (stepConn)
 				{
-					LogMessage(
+					LOG_MESSAGE(
 						"Executing SQL step " + stepid + "(part of job " + m_jobid + ")",
 						 LOG_DEBUG
 					);
-					rc = stepConn->ExecuteVoid(steps->GetString("jstcode"));
-					succeeded = stepConn->LastCommandOk();
-					output = stepConn->GetLastError();
-					stepConn->Return();
-				}
-				else
-				{
-					output = "Couldn't get a connection to the database!";
-					succeeded = false;
+					RunSqlStep(stepConn);
+					return;
 				}
 
+				output = "Couldn't get a connection to the database!";
+				succeeded = false;
 
 				break;
 			}
 			case 'b':
 			{
 				// Batch jobs are more complex thank SQL, for obvious reasons...
-				LogMessage(
+				LOG_MESSAGE(
 					"Executing batch step" + stepid + "(part of job " + m_jobid + ")",
           LOG_DEBUG
 				);
@@ -180,26 +403,29 @@ int Job::Execute()
 					".scr"
 #endif
 				).str());
+#if BOOST_OS_WINDOWS
 				fs::path errorFilePath(
 					(boost::format("%s_%s_error.txt") % m_jobid % stepid).str()
 				);
+#endif
 
 				if (!createUniqueTemporaryDirectory(prefix, jobDir))
 				{
 					output = "Couldn't get a temporary filename!";
-					LogMessage(output, LOG_WARNING);
+					LOG_MESSAGE(output, LOG_WARNING);
 					rc = -1;
 
 					break;
 				}
 
 				filepath = jobDir / filepath;
-				errorFilePath = jobDir / errorFilePath;
 
 				std::string filename = filepath.string();
-				std::string errorFile = errorFilePath.string();
+#if BOOST_OS_WINDOWS
+				std::string errorFile = (jobDir / errorFilePath).string();
+#endif
 
-				std::string code = steps->GetString("jstcode");
+				std::string code = m_steps->GetString("jstcode");
 
 				// Cleanup the code. If we're on Windows, we need to make all line ends \r\n,
 				// If we're on Unix, we need \n
@@ -213,7 +439,7 @@ int Job::Execute()
 
 				if (out_file.fail())
 				{
-					LogMessage(
+					LOG_MESSAGE(
 						"Couldn't open temporary script file: " + filename,
 						LOG_WARNING
 					);
@@ -236,7 +462,7 @@ int Job::Execute()
 							filepath, boost::filesystem::owner_all
 						);
 					} catch (const fs::filesystem_error &ex) {
-						LogMessage(
+						LOG_MESSAGE(
 							"Error setting executable permission to file: " +
 							filename, LOG_DEBUG
 						);
@@ -244,15 +470,17 @@ int Job::Execute()
 #endif
 				}
 
-				LogMessage("Executing script file: " + filename, LOG_DEBUG);
+				LOG_MESSAGE("Executing script file: " + filename, LOG_DEBUG);
 
-				// freopen function is used to redirect output of stream (stderr in our case)
-				// into the specified file.
-				FILE *fpError = freopen((const char *)errorFile.c_str(), "w", stderr);
+				std::string errorMsg;
 
 				// Execute the file and capture the output
 #if BOOST_OS_WINDOWS
 				// The Windows way
+				// freopen function is used to redirect output of stream (stderr in our case)
+				// into the specified file.
+				FILE *fpError = freopen((const char *)errorFile.c_str(), "w", stderr);
+
 				HANDLE h_script, h_process;
 				DWORD  dwRead;
 				char   chBuf[4098];
@@ -261,7 +489,7 @@ int Job::Execute()
 
 				if (!h_script)
 				{
-					LogMessage((boost::format(
+					LOG_MESSAGE((boost::format(
 						"Couldn't execute script: %s, GetLastError() returned %d, errno = %d"
 					) % filename.c_str() % GetLastError() % errno).str(), LOG_WARNING);
 					CloseHandle(h_process);
@@ -291,76 +519,81 @@ int Job::Execute()
 				CloseHandle(h_process);
 				CloseHandle(h_script);
 
-#else
-				// The *nix way.
-				FILE *fp_script = nullptr;
-				char  buf[4098];
+				// Check script threw some error into stderr
+				if (fpError)
+				{
+					fclose(fpError);
+					FILE* fpErr = fopen((const char *)errorFile.c_str(), "r");
+
+					if (fpErr)
+					{
+						char buffer[4098];
+
+						while (!feof(fpErr))
+						{
+							if (fgets(buffer, 4096, fpErr) != NULL)
+								errorMsg += buffer;
+						}
+
+						fclose(fpErr);
+					}
+				}
 
-				fp_script = popen((const char *)filename.c_str(), "r");
+#else
+				// The *nix way: stdout and stderr come through pipes of the
+				// script's own, so that any number of scripts can run at once.
+				ChildProcess script;
+				long         timeout = (long)m_steps->GetInt("timeout");
 
-				if (!fp_script)
+				if (!script.Start(filename))
 				{
-					LogMessage((boost::format(
-						"Couldn't execute script: %s, errno = %d"
-					) % filename.c_str() % errno).str(), LOG_WARNING);
+					LOG_MESSAGE((boost::format(
+						"Couldn't execute script: %s, %s"
+					) % filename.c_str() % script.GetError()).str(), LOG_WARNING);
 					rc = -1;
 
-					if(fpError)
-						fclose(fpError);
-
+					if (boost::filesystem::exists(jobDir))
+						boost::filesystem::remove_all(jobDir);
 					break;
 				}
 
+				script.Wait(timeout);
+
+				output = script.Output();
+				errorMsg = script.Errors();
+				rc = script.ExitCode();
 
-				while(!feof(fp_script))
+				if (script.TimedOut())
 				{
-					if (fgets(buf, 4096, fp_script) != NULL)
-						output += (const char *)buf;
+					timedOut = true;
+					output = (boost::format(
+						"Timed out after %.3f seconds\n%s"
+					) % (timeout / 1000.0) % output).str();
+					LOG_MESSAGE(
+						"Batch step " + stepid + " of job " + m_jobid + " timed out",
+						LOG_WARNING
+					);
 				}
-
-				rc = pclose(fp_script);
-
-				if (WIFEXITED(rc))
-					rc = WEXITSTATUS(rc);
-				else
-					rc = -1;
+				else if (script.TermSignal())
+					errorMsg += (boost::format(
+						"Terminated by signal %d\n"
+					) % script.TermSignal()).str();
 
 #endif
 
 				// set success status for batch runs, be pessimistic by default
-				LogMessage(
+				LOG_MESSAGE(
 					(boost::format("Script return code: %d") % rc).str(),
 					LOG_DEBUG
 				);
 
-				succeeded = ((rc == 0) ? true : false);
+				succeeded = ((rc == 0 && !timedOut) ? true : false);
 				// If output is empty then either script did not return any output
 				// or script threw some error into stderr.
-				// Check script threw some error into stderr
-				if (fpError)
-				{
-					fclose(fpError);
-					FILE* fpErr = fopen((const char *)errorFile.c_str(), "r");
-
-					if (fpErr)
-					{
-						char buffer[4098];
-						std::string errorMsg = "";
-
-						while (!feof(fpErr))
-						{
-							if (fgets(buffer, 4096, fpErr) != NULL)
-								errorMsg += buffer;
-						}
-
-						if (errorMsg != "") {
-							std::string errmsg = "Script Error: \n" + errorMsg + "\n";
-							LogMessage("Script Error: \n" + errorMsg + "\n", LOG_WARNING);
-							output += "\n" + errmsg;
-						}
-
-						fclose(fpErr);
-					}
+				if (errorMsg != "") {
+					std::string errmsg = "Script Error: \n" + errorMsg + "\n";
+					LOG_MESSAGE("Script Error: \n" + errorMsg + "\n", LOG_WARNING);
+					output += "\n" + errmsg;
 				}
 
 				// Delete the file/directory. If we fail, don't overwrite the script
@@ -373,7 +606,7 @@ int Job::Execute()
 				catch (boost::filesystem::filesystem_error const & e)
 				{
 					//display error message
-					LogMessage((const char *)e.what(), LOG_WARNING);
+					LOG_MESSAGE((const char *)e.what(), LOG_WARNING);
 					break;
 				}
 
@@ -382,77 +615,17 @@ int Job::Execute()
 			default:
 			{
 				output = "Invalid step type!";
-				LogMessage("Invalid step type!", LOG_WARNING);
+				LOG_MESSAGE("Invalid step type!", LOG_WARNING);
 				m_status = "i";
-				return -1;
+				return;
 			}
 		}
 
-		std::string stepstatus;
-		if (succeeded)
-			stepstatus = "s";
-		else
-			stepstatus = steps->GetString("jstonerror");
-
-		rc = m_threadConn->ExecuteVoid(
-			"UPDATE pgagent.pga_jobsteplog "
-			"   SET jslduration = now() - jslstart, "
-			"       jslresult = " + NumToStr(rc) + ", jslstatus = '" + stepstatus + "', " +
-			"       jsloutput = " + m_threadConn->qtDbString(output) + " " +
-			" WHERE jslid=" + jslid);
-		if (rc != 1 || stepstatus == "f")
-		{
-			m_status = "f";
-			return -1;
-		}
-		steps->MoveNext();
+		if (!EndStep(rc, succeeded, output, timedOut))
+			return;
+
+		m_steps->MoveNext();
 	}
 
 	m_status = "s";
-	return 0;
-}
-
-
-JobThread::JobThread(const std::string &jid)
-    : m_jobid(jid)
-{
-	LogMessage("Creating job thread for job " + m_jobid, LOG_DEBUG);
-}
-
-
-JobThread::~JobThread()
-{
-	LogMessage("Destroying job thread for job " + m_jobid, LOG_DEBUG);
-}
-
-
-void JobThread::operator()()
-{
-	DBconn *threadConn = DBconn::Get();
-
-	if (threadConn)
-	{
-		Job job(threadConn, m_jobid);
-
-		if (job.Runnable())
-		{
-			job.Execute();
-		}
-		else
-		{
-			LogMessage("Failed to launch the thread for job " + m_jobid +
-			". Inserting an entry to the joblog table with status 'i'", LOG_WARNING);
-
-			// Failed to launch the thread. Insert an entry with
-			// "internal error" status in the joblog table, to leave
-			// a trace of fact that we tried to launch the job.
-			DBresultPtr res = threadConn->Execute(
-				"INSERT INTO pgagent.pga_joblog(jlgid, jlgjobid, jlgstatus) "
-				"VALUES (nextval('pgagent.pga_joblog_jlgid_seq'), " +
-				m_jobid + ", 'i')"
-			);
-			if (res)
-				res = NULL;
-		}
-	}
 }
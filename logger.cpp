@@ -0,0 +1,634 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// pgAgent - PostgreSQL Tools
+//
+// Copyright (C) 2002 - 2024, The pgAdmin Development Team
+// This software is released under the PostgreSQL Licence
+//
+// logger.cpp - log file written by a thread of its own
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pgAgent.h"
+
+static thread_local const LogContext *s_context = NULL;
+
+
+LogScope::LogScope(const LogContext &context)
+{
+	m_previous = s_context;
+	s_context = &context;
+}
+
+
+LogScope::~LogScope()
+{
+	s_context = m_previous;
+}
+
+
+const LogContext *LogScope::Current()
+{
+	return s_context;
+}
+
+// *nix only!!
+#ifndef WIN32
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// Largest batch of messages given to a single write()
+#define LOG_BATCH_SIZE 65536
+
+// Longest time the writer sleeps without checking for messages, in ms
+#define LOG_IDLE_WAIT 100
+
+// Set by SIGHUP; the writer closes the log file, and opens it again
+static volatile sig_atomic_t s_reopen = 0;
+
+
+// The timestamp which starts every line, e.g. "Fri Oct 16 9:05:03 2026 ",
+// formatted again only once per second in each thread.
+static void AppendTime(std::string &line)
+{
+	static const char *days[] = {
+		"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+	};
+	static const char *months[] = {
+		"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+		"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+	};
+	static thread_local time_t lastTime = 0;
+	static thread_local char   timeString[64];
+
+	time_t now = time(NULL);
+
+	if (now != lastTime)
+	{
+		struct tm tm;
+
+		localtime_r(&now, &tm);
+		snprintf(
+			timeString, sizeof(timeString), "%s %s %d %02d:%02d:%02d %d ",
+			days[tm.tm_wday], months[tm.tm_mon], tm.tm_mday,
+			tm.tm_hour, tm.tm_min, tm.tm_sec, tm.tm_year + 1900
+		);
+		lastTime = now;
+	}
+
+	line += timeString;
+}
+
+
+// The same, in ISO 8601 form and in UTC, for the JSON records
+static void AppendIsoTime(std::string &line)
+{
+	static thread_local time_t lastTime = 0;
+	static thread_local char   timeString[32];
+
+	time_t now = time(NULL);
+
+	if (now != lastTime)
+	{
+		struct tm tm;
+
+		gmtime_r(&now, &tm);
+		strftime(timeString, sizeof(timeString), "%Y-%m-%dT%H:%M:%SZ", &tm);
+		lastTime = now;
+	}
+
+	line += timeString;
+}
+
+
+static void AppendJsonString(std::string &line, const std::string &str)
+{
+	line += '"';
+	for (size_t i = 0; i < str.size(); i++)
+	{
+		unsigned char c = str[i];
+
+		switch (c)
+		{
+			case '"':  line += "\\\""; break;
+			case '\\': line += "\\\\"; break;
+			case '\n': line += "\\n"; break;
+			case '\r': line += "\\r"; break;
+			case '\t': line += "\\t"; break;
+			default:
+				if (c < 0x20)
+				{
+					char escaped[8];
+
+					snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+					line += escaped;
+				}
+				else
+					line += c;
+		}
+	}
+	line += '"';
+}
+
+
+// A message as a line of text, or a JSON object, e.g.
+// {"ts_us":..., "time":"...", "level":"debug", "thread":3, "job":"12",
+//  "log":"345", "step":"67", "phase":"step", "elapsed_us":1500, "msg":"..."}
+// where "ts_us" comes from the monotonic clock, and the job fields, from the
+// context of the thread, if any.
+static void Format(std::string &line, int level, const std::string &msg)
+{
+	static std::atomic<int>  threads(0);
+	static thread_local int  thread = ++threads;
+
+	const char *name;
+
+	switch (level)
+	{
+		case LOG_ERROR:   name = "error"; break;
+		case LOG_DEBUG:   name = "debug"; break;
+		default:          name = "warning"; break;
+	}
+
+	if (logFormat != "json")
+	{
+		AppendTime(line);
+		for (const char *c = name; *c; c++)
+			line += toupper(*c);
+		line += ": ";
+		line += msg;
+		line += '\n';
+		return;
+	}
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	const LogContext *context = LogScope::Current();
+
+	line += "{\"ts_us\":";
+	line += std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(
+		now.time_since_epoch()).count());
+	line += ",\"time\":\"";
+	AppendIsoTime(line);
+	line += "\",\"level\":\"";
+	line += name;
+	line += "\",\"thread\":";
+	line += std::to_string(thread);
+
+	if (context)
+	{
+		line += ",\"job\":";
+		AppendJsonString(line, context->jobid);
+		line += ",\"log\":";
+		AppendJsonString(line, context->logid);
+		if (!context->stepid.empty())
+		{
+			line += ",\"step\":";
+			AppendJsonString(line, context->stepid);
+		}
+		line += ",\"phase\":\"";
+		line += context->phase;
+		line += "\",\"elapsed_us\":";
+		line += std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(
+			now - context->since).count());
+	}
+
+	line += ",\"msg\":";
+	AppendJsonString(line, msg);
+	line += "}\n";
+}
+
+
+Logger &Logger::Get()
+{
+	// Never deleted, as messages may still be logged at exit
+	static Logger *logger = new Logger(logBufferSize);
+
+	return *logger;
+}
+
+
+Logger::Logger(size_t size)
+	: m_tail(0), m_head(0), m_running(false), m_sleeping(false), m_dropped(0),
+	  m_queued(0), m_written(0), m_thread(NULL), m_stop(false), m_fd(-1),
+	  m_openFailed(false), m_size(0), m_opened(0)
+{
+	size_t capacity = 2;
+
+	while (capacity < size)
+		capacity <<= 1;
+
+	m_cells = std::vector<Cell>(capacity);
+	m_mask = capacity - 1;
+
+	for (size_t i = 0; i < capacity; i++)
+		m_cells[i].seq.store(i, std::memory_order_relaxed);
+}
+
+
+// Bounded multi-producer queue, after Dmitry Vyukov's: each cell has a
+// sequence number telling whether it is free for the producer at a given
+// position, or holds the message the consumer expects there.
+bool Logger::Push(std::string &msg)
+{
+	size_t pos = m_tail.load(std::memory_order_relaxed);
+	Cell  *cell;
+
+	while (true)
+	{
+		cell = &m_cells[pos & m_mask];
+
+		size_t seq = cell->seq.load(std::memory_order_acquire);
+		long   diff = (long)seq - (long)pos;
+
+		if (diff == 0)
+		{
+			if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+			return false;
+		else
+			pos = m_tail.load(std::memory_order_relaxed);
+	}
+
+	cell->msg.swap(msg);
+	cell->seq.store(pos + 1, std::memory_order_release);
+
+	return true;
+}
+
+
+bool Logger::Pop(std::string &msg)
+{
+	Cell &cell = m_cells[m_head & m_mask];
+
+	if (cell.seq.load(std::memory_order_acquire) != m_head + 1)
+		return false;
+
+	msg.swap(cell.msg);
+	cell.msg.clear();
+	cell.seq.store(m_head + m_mask + 1, std::memory_order_release);
+	m_head++;
+
+	return true;
+}
+
+
+bool Logger::IsEmpty() const
+{
+	return m_cells[m_head & m_mask].seq.load(std::memory_order_acquire) != m_head + 1;
+}
+
+
+void Logger::Write(int level, const std::string &msg, bool mustWait)
+{
+	std::string line;
+
+	line.reserve(64 + msg.size());
+	Format(line, level, msg);
+
+	if (!m_running.load(std::memory_order_acquire))
+		Start();
+
+	mustWait = mustWait || logWhenFull == "wait";
+
+	while (!Push(line))
+	{
+		if (!mustWait)
+		{
+			m_dropped++;
+			Wake();
+			return;
+		}
+
+		Wake();
+		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+	}
+
+	m_queued++;
+
+	if (m_sleeping.load())
+		Wake();
+}
+
+
+void Logger::Wake()
+{
+	boost::unique_lock<boost::mutex> locker(m_lock);
+
+	m_wake.notify_one();
+}
+
+
+void Logger::Flush()
+{
+	unsigned long long queued = m_queued.load();
+
+	if (!m_running.load(std::memory_order_acquire))
+		return;
+
+	boost::unique_lock<boost::mutex> locker(m_lock);
+
+	m_wake.notify_one();
+	while (m_written.load() < queued)
+		m_flushed.wait(locker);
+}
+
+
+void Logger::Start()
+{
+	boost::unique_lock<boost::mutex> locker(m_lock);
+
+	if (m_running.load())
+		return;
+
+	m_stop = false;
+	m_thread = new boost::thread(&Logger::Run, this);
+	m_running.store(true, std::memory_order_release);
+}
+
+
+void Logger::Stop()
+{
+	boost::thread *thread;
+
+	Flush();
+
+	{
+		boost::unique_lock<boost::mutex> locker(m_lock);
+
+		if (!m_running.load())
+			return;
+
+		m_stop = true;
+		m_wake.notify_one();
+		thread = m_thread;
+		m_thread = NULL;
+	}
+
+	thread->join();
+	delete thread;
+
+	CloseFile();
+	m_running.store(false, std::memory_order_release);
+}
+
+
+void Logger::Run()
+{
+	std::string batch, msg;
+
+	batch.reserve(LOG_BATCH_SIZE);
+
+	while (true)
+	{
+		unsigned long long count = 0;
+
+		while (batch.size() < LOG_BATCH_SIZE && Pop(msg))
+		{
+			batch += msg;
+			count++;
+		}
+
+		long dropped = m_dropped.exchange(0);
+
+		if (dropped)
+			Format(
+				batch, LOG_WARNING, std::to_string(dropped) +
+				" messages could not be logged, the log buffer being full"
+			);
+
+		if (!batch.empty())
+		{
+			WriteOut(batch);
+			batch.clear();
+
+			boost::unique_lock<boost::mutex> locker(m_lock);
+
+			m_written += count;
+			m_flushed.notify_all();
+			continue;
+		}
+
+		boost::unique_lock<boost::mutex> locker(m_lock);
+
+		if (m_stop)
+			break;
+
+		// A message queued after this check finds m_sleeping set, and wakes
+		// us up; the lock keeps it from doing so before we wait.
+		m_sleeping.store(true);
+		if (IsEmpty() && !m_dropped.load())
+			m_wake.timed_wait(locker, boost::posix_time::milliseconds(LOG_IDLE_WAIT));
+		m_sleeping.store(false);
+	}
+}
+
+
+void Logger::RequestReopen()
+{
+	s_reopen = 1;
+}
+
+
+void Logger::CloseFile()
+{
+	if (m_fd > STDERR_FILENO)
+		close(m_fd);
+	m_fd = -1;
+}
+
+
+// Whether the log file is due for rotation before 'bytes' more are written
+bool Logger::IsRotationDue(size_t bytes) const
+{
+	if (logFile.empty() || m_fd < 0)
+		return false;
+
+	if (logRotateSize > 0 && m_size > 0 &&
+		m_size + (long long)bytes > logRotateSize * 1024LL * 1024LL)
+		return true;
+
+	if (logRotateAge > 0 && time(NULL) - m_opened >= logRotateAge)
+		return true;
+
+	return false;
+}
+
+
+// Rename the log file after the time it is rotated at, e.g.
+// pgagent.log.20261016-093000, compress it if asked to, and remove the oldest
+// rotated files beyond 'logRotateKeep'. The next batch opens a new file.
+void Logger::Rotate()
+{
+	char   suffix[32];
+	time_t now = time(NULL);
+	struct tm tm;
+
+	CloseFile();
+
+	localtime_r(&now, &tm);
+	strftime(suffix, sizeof(suffix), ".%Y%m%d-%H%M%S", &tm);
+
+	std::string rotated = logFile + suffix;
+
+	for (int i = 1; boost::filesystem::exists(rotated) ||
+		boost::filesystem::exists(rotated + ".gz"); i++)
+		rotated = logFile + suffix + "-" + std::to_string(i);
+
+	if (rename(logFile.c_str(), rotated.c_str()) != 0)
+	{
+		// Already moved away otherwise
+		if (errno != ENOENT)
+			fprintf(stderr, "Can not rotate the logfile '%s'\n", logFile.c_str());
+		return;
+	}
+
+	PruneRotated();
+
+#ifdef HAVE_ZLIB
+	// Out of the way of the messages
+	if (logRotateCompress)
+		boost::thread(&Logger::Compress, rotated).detach();
+#endif
+}
+
+
+void Logger::PruneRotated()
+{
+	namespace fs = boost::filesystem;
+
+	if (logRotateKeep <= 0)
+		return;
+
+	fs::path    path(logFile);
+	fs::path    dir = path.has_parent_path() ? path.parent_path() : fs::path(".");
+	std::string prefix = path.filename().string() + ".";
+	std::vector<std::string> rotated;
+	boost::system::error_code ec;
+
+	for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+	{
+		std::string name = it->path().filename().string();
+
+		// The timestamp suffix starts with the year
+		if (name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0 &&
+			isdigit((unsigned char)name[prefix.size()]))
+			rotated.push_back(name);
+	}
+
+	// The timestamps sort in time order
+	std::sort(rotated.begin(), rotated.end());
+
+	for (size_t i = 0; i + logRotateKeep < rotated.size(); i++)
+		fs::remove(dir / rotated[i], ec);
+}
+
+
+#ifdef HAVE_ZLIB
+// Replace 'file' with its gzip'ed version; it is left as it is on failure.
+void Logger::Compress(const std::string &file)
+{
+	std::string  compressed = file + ".gz";
+	FILE        *in = fopen(file.c_str(), "rb");
+	gzFile       out;
+	char         buffer[65536];
+	size_t       read;
+	bool         ok = true;
+
+	if (in == NULL)
+		return;
+
+	out = gzopen(compressed.c_str(), "wb");
+	if (out == NULL)
+	{
+		fclose(in);
+		return;
+	}
+
+	while (ok && (read = fread(buffer, 1, sizeof(buffer), in)) > 0)
+		ok = (gzwrite(out, buffer, (unsigned)read) == (int)read);
+
+	ok = !ferror(in) && gzclose(out) == Z_OK && ok;
+	fclose(in);
+
+	if (ok)
+		unlink(file.c_str());
+	else
+		unlink(compressed.c_str());
+}
+#endif
+
+
+void Logger::WriteOut(const std::string &batch)
+{
+	// Asked for by SIGHUP, e.g. once logrotate has moved the file away
+	if (s_reopen)
+	{
+		s_reopen = 0;
+		CloseFile();
+	}
+
+	if (IsRotationDue(batch.size()))
+		Rotate();
+
+	if (m_fd < 0)
+	{
+		if (logFile.empty())
+			m_fd = STDOUT_FILENO;
+		else
+		{
+			struct stat st;
+
+			m_fd = open(logFile.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+			if (m_fd < 0)
+			{
+				// Said once, until the file can be opened again; the
+				// messages are lost meanwhile.
+				if (!m_openFailed)
+					fprintf(stderr, "Can not open the logfile '%s'", logFile.c_str());
+				m_openFailed = true;
+				return;
+			}
+			m_openFailed = false;
+
+			// The age of the file counts from when it was opened
+			m_size = (fstat(m_fd, &st) == 0 ? (long long)st.st_size : 0);
+			m_opened = time(NULL);
+		}
+	}
+
+	const char *data = batch.data();
+	size_t      left = batch.size();
+
+	while (left > 0)
+	{
+		ssize_t written = write(m_fd, data, left);
+
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			// Opened again for the next batch
+			CloseFile();
+			return;
+		}
+
+		data += written;
+		left -= written;
+		m_size += written;
+	}
+}
+
+#endif // !WIN32
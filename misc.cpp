@@ -47,6 +47,119 @@ std::string getArg(int &argc, char **&argv)
 	return res;
 }
 
+// The long options, given as either --name=value or --name value
+static bool setLongOption(const std::string &name, const std::string &value)
+{
+	if (name == "max-wait")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val > 0)
+			maxWait = val;
+	}
+	else if (name == "workers")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val > 0)
+			workers = val;
+	}
+	else if (name == "max-jobs")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val > 0)
+			maxJobs = val;
+	}
+	else if (name == "reserved-workers")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val >= 0)
+			reservedWorkers = val;
+	}
+	else if (name == "pool-min-idle")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val >= 0)
+			poolMinIdle = val;
+	}
+	else if (name == "pool-max-idle")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val >= 0)
+			poolMaxIdle = val;
+	}
+	else if (name == "pool-idle-timeout")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val >= 0)
+			poolIdleTimeout = val;
+	}
+	else if (name == "pool-max-lifetime")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val >= 0)
+			poolMaxLifetime = val;
+	}
+	else if (name == "pool-prewarm")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val >= 0)
+			poolPrewarm = val;
+	}
+	else if (name == "connect-timeout")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val >= 0)
+			connectTimeout = val;
+	}
+#if !BOOST_OS_WINDOWS
+	else if (name == "log-buffer")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val > 0)
+			logBufferSize = val;
+	}
+	else if (name == "log-when-full")
+	{
+		if (value != "drop" && value != "wait")
+			return false;
+		logWhenFull = value;
+	}
+	else if (name == "log-format")
+	{
+		if (value != "text" && value != "json")
+			return false;
+		logFormat = value;
+	}
+	else if (name == "log-rotate-size")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val >= 0)
+			logRotateSize = val;
+	}
+	else if (name == "log-rotate-age")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val >= 0)
+			logRotateAge = val;
+	}
+	else if (name == "log-rotate-keep")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val >= 0)
+			logRotateKeep = val;
+	}
+	else if (name == "log-rotate-compress")
+	{
+		int val = atoi((const char*)value.c_str());
+		if (val >= 0)
+			logRotateCompress = val;
+	}
+#endif
+	else
+		return false;
+
+	return true;
+}
+
 void printVersion()
 {
 	printf("PostgreSQL Scheduling Agent\n");
@@ -87,6 +200,32 @@ void setOptions(int argc, char **argv, const std::string &executable)
 					printVersion();
 					exit(0);
 				}
+				case '-':
+				{
+					std::string name = argv[0] + 2, value;
+					std::string::size_type pos = name.find('=');
+
+					if (pos != std::string::npos)
+					{
+						value = name.substr(pos + 1);
+						name.erase(pos);
+					}
+					else if (argc >= 1)
+					{
+						argc--;
+						argv++;
+						value = argv[0];
+					}
+					else
+						LogMessage("Invalid command line argument", LOG_ERROR);
+
+					if (!setLongOption(name, value))
+					{
+						usage(executable);
+						exit(1);
+					}
+					break;
+				}
 #if !BOOST_OS_WINDOWS
 				case 'f':
 				{
@@ -11,6 +11,9 @@
 
 #include "pgAgent.h"
 
+#include <atomic>
+#include <set>
+
 #if !BOOST_OS_WINDOWS
 #include <unistd.h>
 #endif
@@ -19,28 +22,276 @@ std::string connectString;
 std::string backendPid;
 long        longWait = 30;
 long        shortWait = 5;
+long        maxWait = 60;
+long        workers = 10;
+long        maxJobs = 0;
+long        reservedWorkers = 0;
+long        poolMinIdle = 0;
+long        poolMaxIdle = 5;
+long        poolIdleTimeout = 300;
+long        poolMaxLifetime = 3600;
+long        poolPrewarm = 0;
+long        connectTimeout = 30;
 long        minLogLevel = LOG_ERROR;
 
 using namespace std;
 
 #define MAXATTEMPTS 10
 
+// Runs the jobs; created once, and kept across reconnections
+static WorkerPool *workerPool = NULL;
+
+// Number of jobs with a priority of 0 or less being run by the workers
+static std::atomic<long> lowPriorityRunning(0);
+
 #if !BOOST_OS_WINDOWS
 bool        runInForeground = false;
 std::string logFile;
+long        logBufferSize = 4096;
+std::string logWhenFull = "drop";
+std::string logFormat = "text";
+long        logRotateSize = 0;
+long        logRotateAge = 0;
+long        logRotateKeep = 5;
+long        logRotateCompress = 0;
 
 #else
 // pgAgent Initialized
 void        Initialized();
 #endif
 
+// Maximum number of jobs claimed by a single statement
+#define CLAIM_BATCH 100
+
+// The statements the main loop runs over and over on the service connection
+static const DBstatement sqlClaimJobs = {
+	"pga_claim_jobs",
+	"SELECT jobid, logid, jobpriority "
+	"  FROM pgagent.pga_claim_jobs($1, $2, $3, $4)"
+};
+
+static const DBstatement sqlJobTimers = {
+	"pga_job_timers",
+	"SELECT jobid, CEIL(EXTRACT(EPOCH FROM jobnextrun - now()) * 1000) AS duein "
+	"  FROM pgagent.pga_job "
+	" WHERE jobenabled "
+	"   AND jobagentid IS NULL "
+	"   AND jobnextrun IS NOT NULL "
+	"   AND (jobhostagent = '' OR jobhostagent = $1)"
+};
+
+static const DBstatement sqlSomeJobTimers = {
+	"pga_some_job_timers",
+	"SELECT jobid, CEIL(EXTRACT(EPOCH FROM jobnextrun - now()) * 1000) AS duein "
+	"  FROM pgagent.pga_job "
+	" WHERE jobenabled "
+	"   AND jobagentid IS NULL "
+	"   AND jobnextrun IS NOT NULL "
+	"   AND (jobhostagent = '' OR jobhostagent = $1) "
+	"   AND jobid = ANY($2::int4[])"
+};
+
+static const DBstatement sqlPrewarmTargets = {
+	"pga_prewarm_targets",
+	"SELECT '' AS connstr, '' AS dbname, count(*) AS jobs "
+	"  FROM pgagent.pga_job J "
+	" WHERE J.jobenabled "
+	"   AND J.jobagentid IS NULL "
+	"   AND J.jobnextrun <= now() + $2::float8 * '1 second'::interval "
+	"   AND (J.jobhostagent = '' OR J.jobhostagent = $1) "
+	"UNION ALL "
+	"SELECT S.jstconnstr, S.jstdbname, count(DISTINCT J.jobid) "
+	"  FROM pgagent.pga_job J "
+	"  JOIN pgagent.pga_jobstep S ON S.jstjobid = J.jobid "
+	" WHERE J.jobenabled "
+	"   AND J.jobagentid IS NULL "
+	"   AND J.jobnextrun <= now() + $2::float8 * '1 second'::interval "
+	"   AND (J.jobhostagent = '' OR J.jobhostagent = $1) "
+	"   AND S.jstenabled "
+	"   AND S.jstkind = 's' "
+	" GROUP BY S.jstconnstr, S.jstdbname"
+};
+
+// Claim up to 'limit' due jobs for this agent, no more than 'lowLimit' of
+// them with a priority of 0 or less, and create their job log entries, in a
+// single statement. Returns the job and job log ids and the job priorities,
+// highest priority first, or NULL on failure.
+static DBresult *ClaimDueJobs(
+	DBconn *serviceConn, const std::string &host_name, int limit, int lowLimit
+)
+{
+	// pga_claim_jobs() applies the concurrency limits of the job classes and
+	// target databases, and creates the log entries of the jobs it claims.
+	return serviceConn->Execute(
+		sqlClaimJobs, {backendPid, host_name, NumToStr(limit), NumToStr(lowLimit)}
+	);
+}
+
+
+// Claim as many of the jobs which are due now as there is room for in the
+// worker pool, and hand them to the workers. The last 'reservedWorkers' of
+// the 'maxJobs' are kept for the jobs with a priority above 0. The ids of
+// the jobs started are added to 'dispatched', if given.
+static int DispatchDueJobs(
+	DBconn *serviceConn, const std::string &host_name,
+	std::set<std::string> *dispatched
+)
+{
+	int count = 0;
+	int claimed, limit, lowLimit;
+
+	LOG_MESSAGE("Checking for jobs to run", LOG_DEBUG);
+
+	while ((limit = (int)std::min<size_t>(workerPool->Available(), CLAIM_BATCH)) > 0)
+	{
+		lowLimit = (int)std::max<long>(
+			0, std::min<long>(limit, maxJobs - reservedWorkers - lowPriorityRunning)
+		);
+
+		DBresultPtr res = ClaimDueJobs(serviceConn, host_name, limit, lowLimit);
+
+		if (!res)
+			LogMessage("Failed to query jobs table!", LOG_ERROR);
+
+		claimed = 0;
+
+		while (res->HasData())
+		{
+			std::string jobid = res->GetString("jobid");
+			std::string logid = res->GetString("logid");
+			bool lowPriority = (res->GetInt("jobpriority") <= 0);
+			DBconn *threadConn = DBconn::Get();
+
+			claimed++;
+
+			if (lowPriority)
+				lowPriorityRunning++;
+
+			if (threadConn && Job::Start(
+					threadConn, jobid, logid, workerPool,
+					[lowPriority]()
+					{
+						if (lowPriority)
+							lowPriorityRunning--;
+						workerPool->Release();
+					}))
+			{
+				if (dispatched != NULL)
+					dispatched->insert(jobid);
+
+				count++;
+			}
+			else
+			{
+				LOG_MESSAGE(
+					"Failed to launch the thread for job " + jobid +
+					". Setting the status of its joblog entry to 'i'", LOG_WARNING
+				);
+
+				if (lowPriority)
+					lowPriorityRunning--;
+
+				if (threadConn)
+					threadConn->Return();
+
+				// Leave a trace of the fact that we tried to launch the job,
+				// and give it back.
+				Job::Finish(serviceConn, jobid, logid, "i");
+			}
+
+			res->MoveNext();
+		}
+
+		if (claimed < limit)
+			break;
+	}
+
+	return count;
+}
+
+
+// Read the next run time of the given jobs (all of them, if 'jobids' is
+// NULL) into the timer queue. Jobs which are disabled, being run by an agent
+// or not scheduled any more are removed from the queue. If 'overdue' is
+// given, the jobs which are due already are added to it instead.
+static void LoadTimers(
+	DBconn *serviceConn, const std::string &host_name, TimerQueue &timers,
+	const std::set<std::string> *jobids, std::set<std::string> *overdue = NULL
+)
+{
+	DBresultPtr res(NULL);
+
+	if (jobids != NULL)
+	{
+		std::string filter;
+
+		for (std::set<std::string>::const_iterator it = jobids->begin(); it != jobids->end(); ++it)
+		{
+			filter += (filter.empty() ? "" : ",") + *it;
+			timers.Remove(*it);
+		}
+
+		res = serviceConn->Execute(sqlSomeJobTimers, {host_name, "{" + filter + "}"});
+	}
+	else
+		res = serviceConn->Execute(sqlJobTimers, {host_name});
+
+	if (!res)
+		LogMessage("Failed to query jobs table!", LOG_ERROR);
+
+	TimerQueue::time_point now = std::chrono::steady_clock::now();
+
+	while (res->HasData())
+	{
+		long long duein = res->GetInt("duein");
+
+		if (overdue != NULL && duein <= 0)
+			overdue->insert(res->GetString("jobid"));
+		else
+			timers.Set(res->GetString("jobid"), now + std::chrono::milliseconds(duein));
+
+		res->MoveNext();
+	}
+}
+
+
+// Open the connections needed by the jobs due within --pool-prewarm seconds:
+// one for the job itself, and one for each database its SQL steps run on.
+static void PrewarmConnections(DBconn *serviceConn, const std::string &host_name)
+{
+	DBresultPtr res = serviceConn->Execute(
+		sqlPrewarmTargets, {host_name, NumToStr(poolPrewarm)}
+	);
+
+	if (!res)
+		return;
+
+	std::vector<PoolTarget> targets;
+
+	while (res->HasData())
+	{
+		PoolTarget target = {
+			res->GetString("connstr"), res->GetString("dbname"),
+			(long)res->GetInt("jobs")
+		};
+
+		if (target.count > 0)
+			targets.push_back(target);
+
+		res->MoveNext();
+	}
+
+	DBconn::Prewarm(targets);
+}
+
+
 int MainRestartLoop(DBconn *serviceConn)
 {
 	// clean up old jobs
 
 	int rc;
 
-	LogMessage("Clearing zombies", LOG_DEBUG);
+	LOG_MESSAGE("Clearing zombies", LOG_DEBUG);
 	rc = serviceConn->ExecuteVoid("CREATE TEMP TABLE pga_tmp_zombies(jagpid int4)");
 
 	if (serviceConn->BackendMinimumVersion(9, 2))
@@ -99,42 +350,195 @@ int MainRestartLoop(DBconn *serviceConn)
 	if (rc < 0)
 		return rc;
 
-	while (1)
+	// Job and schedule changes are announced on the 'pgagent_job' channel by
+	// the triggers on pga_job, so we can keep the next run time of every job
+	// in memory and sleep until either one of them is due or a notification
+	// arrives, rather than polling the catalog.
+	bool listening = (serviceConn->ExecuteVoid("LISTEN pgagent_job") >= 0);
+
+	if (!listening)
 	{
-		bool foundJobToExecute = false;
-
-		LogMessage("Checking for jobs to run", LOG_DEBUG);
-		DBresultPtr res = serviceConn->Execute(
-			"SELECT J.jobid "
-			"  FROM pgagent.pga_job J "
-			" WHERE jobenabled "
-			"   AND jobagentid IS NULL "
-			"   AND jobnextrun <= now() "
-			"   AND (jobhostagent = '' OR jobhostagent = '" + host_name + "')"
-			" ORDER BY jobnextrun"
+		LOG_MESSAGE(
+			"Couldn't listen for job notifications, polling every " +
+			NumToStr(shortWait) + " seconds instead", LOG_WARNING
 		);
 
-		if (res)
+		while (1)
 		{
-			while (res->HasData())
-			{
-				std::string jobid = res->GetString("jobid");
+			DispatchDueJobs(serviceConn, host_name, NULL);
+			DBconn::MaintainPool();
 
-				boost::thread job_thread = boost::thread(JobThread(jobid));
-				job_thread.detach();
-				foundJobToExecute = true;
-				res->MoveNext();
+			LOG_MESSAGE("Sleeping...", LOG_DEBUG);
+			WaitAWhile();
+		}
+	}
+
+	TimerQueue                timers;
+	TimerQueue::time_point    lastSync;
+	TimerQueue::time_point    lastPrewarm;
+	TimerQueue::time_point    lastMaintenance;
+	std::set<std::string>     changed;
+	std::set<std::string>     held;
+	size_t                    heldAvailable = 0;
+	long                      heldLowRunning = 0;
+	std::vector<std::string>  payloads;
+	bool                      resync = true;
+
+	while (1)
+	{
+		TimerQueue::time_point now = std::chrono::steady_clock::now();
+
+		// One of our own jobs has finished since the held jobs were put
+		// aside, which may have made room for them. Its notification may
+		// have arrived before it gave back its place in the pool.
+		if (!held.empty() &&
+			(workerPool->Available() > heldAvailable || lowPriorityRunning < heldLowRunning))
+		{
+			changed.insert(held.begin(), held.end());
+			held.clear();
+		}
+
+		// Re-read everything once in a while, in case we missed a change
+		// (e.g. a job which was being run by an agent that went away).
+		if (resync || now - lastSync >= std::chrono::seconds(maxWait))
+		{
+			timers.Clear();
+			changed.clear();
+			held.clear();
+			LoadTimers(serviceConn, host_name, timers, NULL);
+			lastSync = now;
+			resync = false;
+		}
+		else if (!changed.empty())
+		{
+			LoadTimers(serviceConn, host_name, timers, &changed);
+			changed.clear();
+		}
+
+		std::set<std::string>  due;
+		std::string            jobid;
+		bool                   busy = (workerPool->Available() == 0);
+
+		// Due jobs wait in the queue until there is room for them in the pool
+		now = std::chrono::steady_clock::now();
+		while (!busy && timers.PopDue(now, jobid))
+			due.insert(jobid);
+
+		if (!due.empty())
+		{
+			std::set<std::string> dispatched;
+
+			DispatchDueJobs(serviceConn, host_name, &dispatched);
+
+			// A job which was due, but has not been started, has either been
+			// taken by another agent, or is held back by a concurrency limit,
+			// or our clock is slightly ahead of the server's. Re-read them; the
+			// ones which are still due can't be started before some job
+			// changes, so they are put aside until the next notification. The
+			// jobs we have started will be notified back once they finish.
+			std::set<std::string> missed;
+
+			for (std::set<std::string>::iterator it = due.begin(); it != due.end(); ++it)
+			{
+				if (dispatched.find(*it) == dispatched.end())
+					missed.insert(*it);
 			}
-			res = NULL;
 
-			LogMessage("Sleeping...", LOG_DEBUG);
-			WaitAWhile();
+			if (!missed.empty())
+				LoadTimers(serviceConn, host_name, timers, &missed, &held);
+
+			heldAvailable = workerPool->Available();
+			heldLowRunning = lowPriorityRunning;
 		}
-		else
-			LogMessage("Failed to query jobs table!", LOG_ERROR);
 
-		if (!foundJobToExecute)
-			DBconn::ClearConnections();
+		now = std::chrono::steady_clock::now();
+
+		// Open the connections the jobs due soon will need ahead of time, so
+		// that they don't have to wait for them. Look again halfway through
+		// the window at most, for the jobs which have come due meanwhile.
+		std::chrono::milliseconds prewarmWindow(poolPrewarm * 1000);
+
+		if (poolPrewarm > 0 && !timers.Empty() &&
+			timers.NextDue() <= now + prewarmWindow &&
+			now >= lastPrewarm + prewarmWindow / 2)
+		{
+			PrewarmConnections(serviceConn, host_name);
+			lastPrewarm = now;
+		}
+
+		if (now >= lastMaintenance + std::chrono::seconds(1))
+		{
+			DBconn::MaintainPool();
+			lastMaintenance = now;
+		}
+
+		now = std::chrono::steady_clock::now();
+
+		TimerQueue::time_point wakeup = lastSync + std::chrono::seconds(maxWait);
+
+		if (!timers.Empty() && timers.NextDue() < wakeup)
+			wakeup = timers.NextDue();
+
+		if (poolPrewarm > 0 && !timers.Empty())
+		{
+			TimerQueue::time_point prewarm = std::max(
+				timers.NextDue() - prewarmWindow, lastPrewarm + prewarmWindow / 2
+			);
+
+			if (prewarm < wakeup)
+				wakeup = prewarm;
+		}
+
+		// A job finishing is announced by its trigger, but the notification
+		// may arrive before it gives back its place in the pool, so look again
+		// shortly rather than waiting for the next one.
+		if (busy && wakeup < now + std::chrono::seconds(1))
+			wakeup = now + std::chrono::seconds(1);
+
+		// Likewise for the jobs held back for want of a worker kept for the
+		// jobs with a lower priority.
+		if (!held.empty() && workerPool->Available() < (size_t)maxJobs &&
+				wakeup > now + std::chrono::seconds(1))
+			wakeup = now + std::chrono::seconds(1);
+
+		long timeout = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+			wakeup - now
+		).count();
+
+		if (timeout < 0)
+			timeout = 0;
+
+		LOG_MESSAGE(
+			(boost::format("Waiting up to %dms for %d scheduled job(s)...") %
+			 timeout % timers.Size()).str(), LOG_DEBUG
+		);
+
+		payloads.clear();
+		if (serviceConn->WaitForNotification(timeout, &payloads) < 0)
+		{
+			LOG_MESSAGE(
+				"Lost the primary connection while waiting for notifications: " +
+				serviceConn->GetLastError(), LOG_WARNING
+			);
+			return -1;
+		}
+
+		for (size_t i = 0; i < payloads.size(); i++)
+		{
+			long id = atol(payloads[i].c_str());
+
+			// Only trust the payloads sent by our own triggers
+			if (id > 0 && NumToStr(id) == payloads[i])
+				changed.insert(payloads[i]);
+			else
+				resync = true;
+		}
+
+		if (!payloads.empty())
+		{
+			changed.insert(held.begin(), held.end());
+			held.clear();
+		}
 	}
 	return 0;
 }
@@ -144,16 +548,30 @@ void MainLoop()
 {
 	int attemptCount = 1;
 
+	if (maxJobs <= 0)
+		maxJobs = workers;
+
+	if (reservedWorkers >= maxJobs)
+	{
+		LOG_MESSAGE(
+			"--reserved-workers must be lower than --max-jobs, using " +
+			NumToStr(maxJobs - 1) + " instead", LOG_WARNING
+		);
+		reservedWorkers = maxJobs - 1;
+	}
+
+	workerPool = new WorkerPool(workers, maxJobs);
+
 	// OK, let's get down to business
 	do
 	{
-		LogMessage("Creating primary connection", LOG_DEBUG);
+		LOG_MESSAGE("Creating primary connection", LOG_DEBUG);
 		DBconn *serviceConn = DBconn::InitConnection(connectString);
 
 		if (serviceConn)
 		{
 			// Basic sanity check, and a chance to get the serviceConn's PID
-			LogMessage("Database sanity check", LOG_DEBUG);
+			LOG_MESSAGE("Database sanity check", LOG_DEBUG);
 			DBresultPtr res = serviceConn->Execute(
 				"SELECT count(*) As count, pg_backend_pid() AS pid FROM pg_class cl JOIN pg_namespace ns ON ns.oid=relnamespace WHERE relname='pga_job' AND nspname='pgagent'"
 			);
@@ -219,6 +637,25 @@ void MainLoop()
 				);
 			}
 
+			// Jobs are claimed, and their runs logged, by functions which came
+			// with version 4.3 of the extension.
+			res = serviceConn->Execute(
+				"SELECT COUNT(*) "
+				"  FROM pg_proc "
+				" WHERE proname IN ('pga_claim_jobs', 'pga_job_steps', 'pga_step_begin', "
+				"                   'pga_step_end', 'pga_job_end') "
+				"   AND pronamespace = (SELECT oid FROM pg_namespace WHERE nspname = 'pgagent')"
+			);
+
+			if (!res || !res->IsValid() || res->GetString(0) != "5")
+			{
+				LogMessage(
+					"Couldn't find the functions running the jobs - please run ALTER EXTENSION \"pgagent\" UPDATE;.",
+					LOG_ERROR
+				);
+			}
+			res = NULL;
+
 #ifdef WIN32
 			Initialized();
 #endif
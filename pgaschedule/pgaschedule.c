@@ -0,0 +1,621 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// pgAgent - PostgreSQL Tools
+//
+// Copyright (C) 2002 - 2024, The pgAdmin Development Team
+// This software is released under the PostgreSQL Licence
+//
+// pgaschedule.c - native implementation of the schedule functions
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "pgtime.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/timestamp.h"
+
+#if PG_VERSION_NUM >= 120000
+#include "port/pg_bitutils.h"
+#endif
+
+PG_MODULE_MAGIC;
+
+PG_FUNCTION_INFO_V1(pga_next_schedule);
+PG_FUNCTION_INFO_V1(pga_next_schedule_mask);
+
+Datum pga_next_schedule(PG_FUNCTION_ARGS);
+Datum pga_next_schedule_mask(PG_FUNCTION_ARGS);
+
+#define MINUTE_FLAGS    60
+#define HOUR_FLAGS      24
+#define WEEKDAY_FLAGS   7
+#define MONTHDAY_FLAGS  32
+#define MONTH_FLAGS     12
+
+// Bit n - 1 of a mask is element n of the corresponding bool[] array
+#define FLAG(n)         (((uint64) 1) << ((n) - 1))
+#define ALL_FLAGS(n)    (FLAG((n) + 1) - 1)
+
+typedef struct ScheduleException
+{
+	bool      hasdate;
+	DateADT   date;
+	bool      hastime;
+	TimeADT   time;
+} ScheduleException;
+
+typedef struct Schedule
+{
+	uint64    minutes;
+	uint64    hours;
+	uint64    weekdays;
+	uint64    monthdays;
+	uint64    months;
+
+	int                 nexceptions;
+	ScheduleException  *exceptions;
+} Schedule;
+
+
+// Build the mask from a bool[] argument. Missing and NULL elements are
+// considered as not set, just like they are in the PL/pgSQL version.
+static uint64
+get_array_mask(FunctionCallInfo fcinfo, int argno, int size)
+{
+	ArrayType  *arr;
+	Datum      *elems;
+	bool       *nulls;
+	int         nelems, lbound, i;
+	uint64      mask = 0;
+
+	if (PG_ARGISNULL(argno))
+		return 0;
+
+	arr = PG_GETARG_ARRAYTYPE_P(argno);
+
+	if (ARR_NDIM(arr) != 1)
+		return 0;
+
+	lbound = ARR_LBOUND(arr)[0];
+	deconstruct_array(arr, BOOLOID, 1, true, 'c', &elems, &nulls, &nelems);
+
+	for (i = 0; i < nelems; i++)
+	{
+		int idx = lbound + i;
+
+		if (idx >= 1 && idx <= size && !nulls[i] && DatumGetBool(elems[i]))
+			mask |= FLAG(idx);
+	}
+	return mask;
+}
+
+
+static int
+rightmost_one_pos(uint64 mask)
+{
+#if PG_VERSION_NUM >= 120000
+	return pg_rightmost_one_pos64(mask);
+#else
+	int pos = 0;
+
+	while ((mask & 1) == 0)
+	{
+		mask >>= 1;
+		pos++;
+	}
+	return pos;
+#endif
+}
+
+
+// Returns the first flag set between from and to (inclusive), or 0 if there
+// is none.
+static int
+first_flag(uint64 mask, int from, int to)
+{
+	if (from < 1)
+		from = 1;
+	if (from > to)
+		return 0;
+
+	mask &= ~(FLAG(from) - 1) & ALL_FLAGS(to);
+
+	return mask ? rightmost_one_pos(mask) + 1 : 0;
+}
+
+
+static bool
+has_flag(uint64 mask, int idx)
+{
+	return idx >= 1 && idx <= 64 && (mask & FLAG(idx)) != 0;
+}
+
+
+static int
+days_in_month(int month, int year)
+{
+	return day_tab[isleap(year) ? 1 : 0][month - 1];
+}
+
+
+// Read all the exceptions of the schedule once, instead of looking them up
+// for every candidate run time.
+static void
+load_exceptions(int32 jscid, Schedule *sched)
+{
+	Oid      argtypes[1] = { INT4OID };
+	Datum    values[1];
+	uint64   i;
+
+	sched->nexceptions = 0;
+	sched->exceptions = NULL;
+
+	values[0] = Int32GetDatum(jscid);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	if (SPI_execute_with_args(
+			"SELECT jexdate, jextime FROM pgagent.pga_exception WHERE jexscid = $1",
+			1, argtypes, values, NULL, true, 0) != SPI_OK_SELECT)
+		elog(ERROR, "could not read the exceptions of schedule %d", jscid);
+
+	if (SPI_processed > 0)
+	{
+		sched->exceptions = (ScheduleException *)
+			SPI_palloc(sizeof(ScheduleException) * SPI_processed);
+
+		for (i = 0; i < SPI_processed; i++)
+		{
+			HeapTuple          tuple = SPI_tuptable->vals[i];
+			TupleDesc          desc = SPI_tuptable->tupdesc;
+			ScheduleException *exc = &sched->exceptions[i];
+			bool               isnull;
+			Datum              val;
+
+			val = SPI_getbinval(tuple, desc, 1, &isnull);
+			exc->hasdate = !isnull;
+			exc->date = isnull ? 0 : DatumGetDateADT(val);
+
+			val = SPI_getbinval(tuple, desc, 2, &isnull);
+			exc->hastime = !isnull;
+			exc->time = isnull ? 0 : DatumGetTimeADT(val);
+		}
+		sched->nexceptions = (int) SPI_processed;
+	}
+
+	SPI_finish();
+}
+
+
+static bool
+is_exception(const Schedule *sched, DateADT date, TimeADT time)
+{
+	int i;
+
+	for (i = 0; i < sched->nexceptions; i++)
+	{
+		const ScheduleException *exc = &sched->exceptions[i];
+
+		if (exc->hasdate && exc->date == date && (!exc->hastime || exc->time == time))
+			return true;
+		if (!exc->hasdate && exc->hastime && exc->time == time)
+			return true;
+	}
+	return false;
+}
+
+
+// Equivalent of '(year-month-day hour:minute)'::timestamptz::timestamp, i.e.
+// the local time is resolved in the session time zone first, so that times
+// falling into a DST gap are moved the same way.
+static Timestamp
+make_local_timestamp(int year, int month, int day, int hour, int minute)
+{
+	struct pg_tm  tm;
+	TimestampTz   tstz;
+	int           tz;
+
+	if (month < 1 || month > 12 || day < 1 || day > days_in_month(month, year))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_FIELD_OVERFLOW),
+				 errmsg("date/time field value out of range: \"%d-%d-%d %d:%d\"",
+						year, month, day, hour, minute)));
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = year;
+	tm.tm_mon = month;
+	tm.tm_mday = day;
+	tm.tm_hour = hour;
+	tm.tm_min = minute;
+	tm.tm_sec = 0;
+
+	tz = DetermineTimeZoneOffset(&tm, session_timezone);
+
+	if (tm2timestamp(&tm, 0, &tz, &tstz) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				 errmsg("timestamp out of range")));
+
+	return DatumGetTimestamp(
+		DirectFunctionCall1(timestamptz_timestamp, TimestampTzGetDatum(tstz)));
+}
+
+
+static void
+local_fields(Timestamp ts, struct pg_tm *tm)
+{
+	fsec_t fsec;
+
+	if (timestamp2tm(ts, NULL, tm, &fsec, NULL, NULL) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				 errmsg("timestamp out of range")));
+}
+
+
+// Calculates the next run time of the schedule, reading the jscid, jscstart
+// and jscend arguments (which are the same for both SQL functions).
+//
+// This is a direct translation of the PL/pgSQL version in pgagent.sql,
+// including its quirks, so both always agree on the next run time. Please
+// keep them in sync.
+//
+static Datum
+next_schedule(FunctionCallInfo fcinfo, Schedule *sched)
+{
+	TimestampTz   now = GetCurrentTransactionStartTimestamp();
+	TimestampTz   jscstart, jscend = 0, after;
+	bool          hasend = !PG_ARGISNULL(2);
+	Timestamp     nextrun = 0, runafter;
+	struct pg_tm  ra, nr;
+
+	bool          bingo = false, foundval = false;
+	bool          daytweak = false, minutetweak = false;
+	int           i, d;
+	int           nextminute, nexthour, nextday, nextmonth, nextyear;
+
+	// No valid start date has been specified
+	if (PG_ARGISNULL(1))
+		PG_RETURN_NULL();
+
+	jscstart = PG_GETARG_TIMESTAMPTZ(1);
+
+	// The schedule is past its end date
+	if (hasend)
+	{
+		jscend = PG_GETARG_TIMESTAMPTZ(2);
+		if (jscend < now)
+			PG_RETURN_NULL();
+	}
+
+	if (PG_ARGISNULL(0))
+	{
+		sched->nexceptions = 0;
+		sched->exceptions = NULL;
+	}
+	else
+		load_exceptions(PG_GETARG_INT32(0), sched);
+
+	// Get the time to find the next run after. It will just be the later of
+	// now() + 1m and the start date.
+	jscstart = DatumGetTimestampTz(DirectFunctionCall2(
+		timestamptz_trunc, CStringGetTextDatum("minute"),
+		TimestampTzGetDatum(jscstart)));
+	after = DatumGetTimestampTz(DirectFunctionCall2(
+		timestamptz_trunc, CStringGetTextDatum("minute"),
+		TimestampTzGetDatum(now + USECS_PER_MINUTE)));
+
+	if (jscstart > after)
+		after = jscstart;
+
+	runafter = DatumGetTimestamp(
+		DirectFunctionCall1(timestamptz_timestamp, TimestampTzGetDatum(after)));
+
+	//
+	// Enter a loop, generating next run timestamps until we find one
+	// that falls on the required weekday, and is not matched by an exception
+	//
+	while (!bingo)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		local_fields(runafter, &ra);
+
+		//
+		// Get the next run year
+		//
+		nextyear = ra.tm_year;
+
+		//
+		// Get the next run month
+		//
+		nextmonth = ra.tm_mon;
+		if ((i = first_flag(sched->months, nextmonth, 12)) != 0)
+		{
+			nextmonth = i;
+			foundval = true;
+		}
+		else if ((i = first_flag(sched->months, 1, nextmonth - 1)) != 0)
+		{
+			nextmonth = i;
+
+			// Wrap into next year
+			nextyear++;
+			foundval = true;
+		}
+
+		//
+		// Get the next run day
+		//
+		// If the year, or month have incremented, get the lowest day,
+		// otherwise look for the next day matching or after today.
+		if (nextyear > ra.tm_year || nextmonth > ra.tm_mon)
+		{
+			nextday = 1;
+			if ((i = first_flag(sched->monthdays, 1, 32)) != 0)
+			{
+				nextday = i;
+				foundval = true;
+			}
+		}
+		else
+		{
+			nextday = ra.tm_mday;
+			if ((i = first_flag(sched->monthdays, nextday, 32)) != 0)
+			{
+				nextday = i;
+				foundval = true;
+			}
+			else if ((i = first_flag(sched->monthdays, 1, nextday - 1)) != 0)
+			{
+				nextday = i;
+
+				// Wrap into next month
+				if (nextmonth == 12)
+				{
+					nextyear++;
+					nextmonth = 1;
+				}
+				else
+					nextmonth++;
+				foundval = true;
+			}
+		}
+
+		// Was the last day flag selected?
+		if (nextday == 32)
+			nextday = days_in_month(nextmonth, nextyear);
+
+		//
+		// Get the next run hour
+		//
+		// If the year, month or day have incremented, get the lowest hour,
+		// otherwise look for the next hour matching or after the current one.
+		if (nextyear > ra.tm_year || nextmonth > ra.tm_mon ||
+			nextday > ra.tm_mday || daytweak)
+		{
+			nexthour = 0;
+			if ((i = first_flag(sched->hours, 1, 24)) != 0)
+			{
+				nexthour = i - 1;
+				foundval = true;
+			}
+		}
+		else
+		{
+			nexthour = ra.tm_hour;
+			if ((i = first_flag(sched->hours, nexthour + 1, 24)) != 0)
+			{
+				nexthour = i - 1;
+				foundval = true;
+			}
+			else if ((i = first_flag(sched->hours, 1, nexthour)) != 0)
+			{
+				nexthour = i - 1;
+
+				// Wrap into next month
+				d = days_in_month(nextmonth, nextyear);
+
+				if (nextday == d)
+				{
+					nextday = 1;
+					if (nextmonth == 12)
+					{
+						nextyear++;
+						nextmonth = 1;
+					}
+					else
+						nextmonth++;
+				}
+				else
+					nextday++;
+
+				foundval = true;
+			}
+		}
+
+		//
+		// Get the next run minute
+		//
+		// If the year, month day or hour have incremented, get the lowest
+		// minute, otherwise look for the next minute matching or after the
+		// current one.
+		if (nextyear > ra.tm_year || nextmonth > ra.tm_mon ||
+			nextday > ra.tm_mday || nexthour > ra.tm_hour || daytweak)
+		{
+			nextminute = 0;
+			d = minutetweak ? 1 : ra.tm_min;
+			if ((i = first_flag(sched->minutes, d, 60)) != 0)
+			{
+				nextminute = i - 1;
+				foundval = true;
+			}
+		}
+		else
+		{
+			nextminute = ra.tm_min;
+			if ((i = first_flag(sched->minutes, nextminute + 1, 60)) != 0)
+			{
+				nextminute = i - 1;
+				foundval = true;
+			}
+			else if ((i = first_flag(sched->minutes, 1, nextminute)) != 0)
+			{
+				nextminute = i - 1;
+
+				// Wrap into next hour
+				d = days_in_month(nextmonth, nextyear);
+
+				if (nexthour == 23)
+				{
+					nexthour = 0;
+					if (nextday == d)
+					{
+						nextday = 1;
+						if (nextmonth == 12)
+						{
+							nextyear++;
+							nextmonth = 1;
+						}
+						else
+							nextmonth++;
+					}
+					else
+						nextday++;
+				}
+				else
+					nexthour++;
+
+				foundval = true;
+			}
+		}
+
+		// Build the result, and check it is not the same as runafter - this
+		// may happen if all array entries are set to false. In this case, add
+		// a minute.
+		nextrun = make_local_timestamp(
+			nextyear, nextmonth, nextday, nexthour, nextminute);
+
+		if (nextrun == runafter && !foundval)
+			nextrun += USECS_PER_MINUTE;
+
+		// If the result is past the end date, exit.
+		if (hasend && DatumGetBool(DirectFunctionCall2(
+				timestamp_gt_timestamptz, TimestampGetDatum(nextrun),
+				TimestampTzGetDatum(jscend))))
+			PG_RETURN_NULL();
+
+		local_fields(nextrun, &nr);
+
+		// Check to ensure that the nextrun time is actually still valid. Its
+		// possible that wrapped values may have carried the nextrun onto an
+		// invalid time or date.
+		if ((sched->minutes == 0 || has_flag(sched->minutes, nr.tm_min + 1)) &&
+			(sched->hours == 0 || has_flag(sched->hours, nr.tm_hour + 1)) &&
+			(sched->monthdays == 0 || has_flag(sched->monthdays, nr.tm_mday) ||
+			 (sched->monthdays == FLAG(32) &&
+			  (nr.tm_mday == days_in_month(nr.tm_mon, nr.tm_year) ||
+			   (nr.tm_mon == 2 && nr.tm_mday == 28)))) &&
+			(sched->months == 0 || has_flag(sched->months, nr.tm_mon)))
+		{
+			int dow = j2day(date2j(nr.tm_year, nr.tm_mon, nr.tm_mday));
+
+			// Now, check to see if the nextrun time found is a) on an
+			// acceptable weekday, and b) not matched by an exception. If not,
+			// set runafter = nextrun and try again.
+			if (has_flag(sched->weekdays, dow + 1) || sched->weekdays == 0)
+			{
+				DateADT date = date2j(nr.tm_year, nr.tm_mon, nr.tm_mday) -
+					POSTGRES_EPOCH_JDATE;
+				TimeADT time = ((nr.tm_hour * MINS_PER_HOUR + nr.tm_min) *
+					SECS_PER_MINUTE + nr.tm_sec) * USECS_PER_SEC;
+
+				if (is_exception(sched, date, time))
+				{
+					// Nuts - found an exception. Increment the time and try
+					// again
+					runafter = nextrun + USECS_PER_MINUTE;
+					bingo = false;
+					minutetweak = true;
+					daytweak = false;
+				}
+				else
+					bingo = true;
+			}
+			else
+			{
+				// We're on the wrong week day - increment a day and try again.
+				runafter = nextrun + USECS_PER_DAY;
+				bingo = false;
+				minutetweak = false;
+				daytweak = true;
+			}
+		}
+		else
+		{
+			runafter = nextrun + USECS_PER_MINUTE;
+			bingo = false;
+			minutetweak = true;
+			daytweak = false;
+		}
+	}
+
+	PG_RETURN_TIMESTAMPTZ(DatumGetTimestampTz(
+		DirectFunctionCall1(timestamp_timestamptz, TimestampGetDatum(nextrun))));
+}
+
+
+//
+// pga_next_schedule(jscid int4, jscstart timestamptz, jscend timestamptz,
+//                   jscminutes bool[], jschours bool[], jscweekdays bool[],
+//                   jscmonthdays bool[], jscmonths bool[])
+//
+Datum
+pga_next_schedule(PG_FUNCTION_ARGS)
+{
+	Schedule sched;
+
+	sched.minutes = get_array_mask(fcinfo, 3, MINUTE_FLAGS);
+	sched.hours = get_array_mask(fcinfo, 4, HOUR_FLAGS);
+	sched.weekdays = get_array_mask(fcinfo, 5, WEEKDAY_FLAGS);
+	sched.monthdays = get_array_mask(fcinfo, 6, MONTHDAY_FLAGS);
+	sched.months = get_array_mask(fcinfo, 7, MONTH_FLAGS);
+
+	return next_schedule(fcinfo, &sched);
+}
+
+
+//
+// pga_next_schedule_mask(jscid int4, jscstart timestamptz, jscend timestamptz,
+//                        jscminutemask int8, jschourmask int4,
+//                        jscweekdaymask int2, jscmonthdaymask int8,
+//                        jscmonthmask int2)
+//
+Datum
+pga_next_schedule_mask(PG_FUNCTION_ARGS)
+{
+	Schedule sched;
+
+	sched.minutes = PG_ARGISNULL(3) ? 0 :
+		(uint64) PG_GETARG_INT64(3) & ALL_FLAGS(MINUTE_FLAGS);
+	sched.hours = PG_ARGISNULL(4) ? 0 :
+		(uint64) PG_GETARG_INT32(4) & ALL_FLAGS(HOUR_FLAGS);
+	sched.weekdays = PG_ARGISNULL(5) ? 0 :
+		(uint64) PG_GETARG_INT16(5) & ALL_FLAGS(WEEKDAY_FLAGS);
+	sched.monthdays = PG_ARGISNULL(6) ? 0 :
+		(uint64) PG_GETARG_INT64(6) & ALL_FLAGS(MONTHDAY_FLAGS);
+	sched.months = PG_ARGISNULL(7) ? 0 :
+		(uint64) PG_GETARG_INT16(7) & ALL_FLAGS(MONTH_FLAGS);
+
+	return next_schedule(fcinfo, &sched);
+}
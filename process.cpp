@@ -0,0 +1,293 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// pgAgent - PostgreSQL Tools
+//
+// Copyright (C) 2002 - 2024, The pgAdmin Development Team
+// This software is released under the PostgreSQL Licence
+//
+// process.cpp - child process running a batch step
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pgAgent.h"
+
+// *nix only!!
+#ifndef WIN32
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+// Size of the reads from the pipes
+#define PROCESS_READ_SIZE 4096
+
+
+ChildProcess::ChildProcess()
+	: m_pid(-1), m_outFd(-1), m_errFd(-1), m_status(0), m_timedOut(false)
+{
+}
+
+
+ChildProcess::~ChildProcess()
+{
+	if (m_pid > 0)
+	{
+		Kill();
+		Reap();
+	}
+	CloseFds();
+}
+
+
+// A pipe whose ends are not inherited by the children. There is no pipe2()
+// on macOS: the flag is set afterwards, which leaves a window for another
+// worker spawning a script at the same time to inherit the ends. That only
+// delays the end of the output of this script until the other one is over.
+bool ChildProcess::OpenPipe(int fds[2])
+{
+	if (pipe(fds) != 0)
+	{
+		m_error = strerror(errno);
+		return false;
+	}
+
+	if (fcntl(fds[0], F_SETFD, FD_CLOEXEC) != 0 ||
+		fcntl(fds[1], F_SETFD, FD_CLOEXEC) != 0)
+	{
+		m_error = strerror(errno);
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+
+	return true;
+}
+
+
+bool ChildProcess::Start(const std::string &path)
+{
+	int   out[2], err[2];
+	short flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t          attr;
+	sigset_t                   mask, defaults;
+
+	if (!OpenPipe(out))
+		return false;
+	if (!OpenPipe(err))
+	{
+		close(out[0]);
+		close(out[1]);
+		return false;
+	}
+
+	// dup2() clears close-on-exec: the child only keeps the write ends, as
+	// its stdout and stderr.
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+
+	// A process group of its own, to be killed as a whole, and none of the
+	// signal settings of the agent.
+	sigemptyset(&mask);
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGHUP);
+	sigaddset(&defaults, SIGPIPE);
+
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, flags);
+	posix_spawnattr_setpgroup(&attr, 0);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+
+	// The same as popen(path): the shell runs scripts with no #! line too
+	char *argv[] = {
+		(char *)"sh", (char *)"-c", (char *)"\"$0\"", (char *)path.c_str(), NULL
+	};
+
+	int rc = posix_spawn(&m_pid, "/bin/sh", &actions, &attr, argv, environ);
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	close(out[1]);
+	close(err[1]);
+
+	if (rc != 0)
+	{
+		m_error = strerror(rc);
+		m_pid = -1;
+		close(out[0]);
+		close(err[0]);
+		return false;
+	}
+
+	m_outFd = out[0];
+	m_errFd = err[0];
+
+	return true;
+}
+
+
+bool ChildProcess::Wait(long timeout)
+{
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	char buffer[PROCESS_READ_SIZE];
+
+	if (m_pid <= 0)
+		return false;
+
+	while (m_outFd >= 0 || m_errFd >= 0)
+	{
+		struct pollfd fds[2];
+		std::string  *outputs[2];
+		int           nfds = 0;
+		int           wait = -1;
+
+		if (m_outFd >= 0)
+		{
+			fds[nfds].fd = m_outFd;
+			fds[nfds].events = POLLIN;
+			outputs[nfds++] = &m_output;
+		}
+		if (m_errFd >= 0)
+		{
+			fds[nfds].fd = m_errFd;
+			fds[nfds].events = POLLIN;
+			outputs[nfds++] = &m_errors;
+		}
+
+		if (timeout > 0)
+		{
+			long long left = std::chrono::duration_cast<std::chrono::milliseconds>(
+				deadline - std::chrono::steady_clock::now()).count();
+
+			if (left <= 0)
+			{
+				// Whatever it has started goes with it, and the pipes close
+				m_timedOut = true;
+				Kill();
+				break;
+			}
+			wait = (int)std::min(left, 60000LL);
+		}
+
+		int ready = poll(fds, nfds, wait);
+
+		if (ready < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			m_error = strerror(errno);
+			Kill();
+			break;
+		}
+
+		for (int i = 0; i < nfds; i++)
+		{
+			if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+
+			ssize_t got = read(fds[i].fd, buffer, sizeof(buffer));
+
+			if (got > 0)
+				outputs[i]->append(buffer, got);
+			else if (got == 0 || errno != EINTR)
+			{
+				close(fds[i].fd);
+				if (fds[i].fd == m_outFd)
+					m_outFd = -1;
+				else
+					m_errFd = -1;
+			}
+		}
+	}
+
+	CloseFds();
+
+	// The script may have closed its outputs, and still be running
+	while (timeout > 0 && !m_timedOut && m_pid > 0)
+	{
+		pid_t pid = waitpid(m_pid, &m_status, WNOHANG);
+
+		if (pid == m_pid || (pid < 0 && errno != EINTR))
+		{
+			if (pid < 0)
+				m_status = -1;
+			m_pid = -1;
+			break;
+		}
+
+		if (std::chrono::steady_clock::now() >= deadline)
+		{
+			m_timedOut = true;
+			Kill();
+		}
+		else
+			usleep(10000);
+	}
+
+	Reap();
+
+	return !m_timedOut;
+}
+
+
+void ChildProcess::Kill(int sig)
+{
+	if (m_pid > 0)
+		kill(-m_pid, sig);
+}
+
+
+void ChildProcess::Reap()
+{
+	while (m_pid > 0 && waitpid(m_pid, &m_status, 0) < 0)
+	{
+		if (errno != EINTR)
+		{
+			m_status = -1;
+			break;
+		}
+	}
+	m_pid = -1;
+}
+
+
+void ChildProcess::CloseFds()
+{
+	if (m_outFd >= 0)
+		close(m_outFd);
+	if (m_errFd >= 0)
+		close(m_errFd);
+	m_outFd = m_errFd = -1;
+}
+
+
+int ChildProcess::ExitCode() const
+{
+	if (m_status != -1 && WIFEXITED(m_status))
+		return WEXITSTATUS(m_status);
+
+	return -1;
+}
+
+
+int ChildProcess::TermSignal() const
+{
+	if (m_status != -1 && WIFSIGNALED(m_status))
+		return WTERMSIG(m_status);
+
+	return 0;
+}
+
+#endif // !WIN32
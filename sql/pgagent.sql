@@ -53,10 +53,14 @@ jobcreated           timestamptz          NOT NULL DEFAULT current_timestamp,
 jobchanged           timestamptz          NOT NULL DEFAULT current_timestamp,
 jobagentid           int4                 NULL REFERENCES pgagent.pga_jobagent(jagpid) ON DELETE SET NULL ON UPDATE RESTRICT,
 jobnextrun           timestamptz          NULL,
-joblastrun           timestamptz          NULL
+joblastrun           timestamptz          NULL,
+jobpriority          int2                 NOT NULL DEFAULT 0,
+jobsteptimeout       interval             NULL CHECK (jobsteptimeout > '0')
 ) WITHOUT OIDS;
 COMMENT ON TABLE pgagent.pga_job IS 'Job main entry';
 COMMENT ON COLUMN pgagent.pga_job.jobagentid IS 'Agent that currently executes this job.';
+COMMENT ON COLUMN pgagent.pga_job.jobpriority IS 'Jobs with a higher priority are started first. Jobs with a priority above 0 may use the workers reserved by the agents for them.';
+COMMENT ON COLUMN pgagent.pga_job.jobsteptimeout IS 'Default time limit of the steps of the job, SQL and batch alike, NULL for none';
 
 
 
@@ -71,12 +75,14 @@ jstcode              text                 NOT NULL,
 jstconnstr           text                 NOT NULL DEFAULT '' CHECK ((jstconnstr != '' AND jstkind = 's' ) OR (jstconnstr = '' AND (jstkind = 'b' OR jstdbname != ''))),
 jstdbname            name                 NOT NULL DEFAULT '' CHECK ((jstdbname != '' AND jstkind = 's' ) OR (jstdbname = '' AND (jstkind = 'b' OR jstconnstr != ''))),
 jstonerror           char                 NOT NULL CHECK (jstonerror IN ('f', 's', 'i')) DEFAULT 'f', -- fail, success, ignore
-jscnextrun           timestamptz          NULL
+jscnextrun           timestamptz          NULL,
+jsttimeout           interval             NULL CHECK (jsttimeout > '0')
 ) WITHOUT OIDS;
 CREATE INDEX pga_jobstep_jobid ON pgagent.pga_jobstep(jstjobid);
 COMMENT ON TABLE pgagent.pga_jobstep IS 'Job step to be executed';
 COMMENT ON COLUMN pgagent.pga_jobstep.jstkind IS 'Kind of jobstep: s=sql, b=batch';
 COMMENT ON COLUMN pgagent.pga_jobstep.jstonerror IS 'What to do if step returns an error: f=fail the job, s=mark step as succeeded and continue, i=mark as fail but ignore it and proceed';
+COMMENT ON COLUMN pgagent.pga_jobstep.jsttimeout IS 'Time after which the step is stopped (an SQL step is cancelled, the process group of a batch step is killed), and handled as per jstonerror. NULL for the default of the job';
 
 
 
@@ -93,14 +99,29 @@ jschours             bool[24]             NOT NULL DEFAULT '{f,f,f,f,f,f,f,f,f,f
 jscweekdays          bool[7]              NOT NULL DEFAULT '{f,f,f,f,f,f,f}',
 jscmonthdays         bool[32]             NOT NULL DEFAULT '{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}',
 jscmonths            bool[12]             NOT NULL DEFAULT '{f,f,f,f,f,f,f,f,f,f,f,f}',
+jscminutemask        int8                 NOT NULL DEFAULT 0,
+jschourmask          int4                 NOT NULL DEFAULT 0,
+jscweekdaymask       int2                 NOT NULL DEFAULT 0,
+jscmonthdaymask      int8                 NOT NULL DEFAULT 0,
+jscmonthmask         int2                 NOT NULL DEFAULT 0,
+jscseconds           bool[60]             NOT NULL DEFAULT '{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}',
+jscsecondmask        int8                 NOT NULL DEFAULT 0,
+jscinterval          interval             NULL,
+jscjitter            interval             NOT NULL DEFAULT '0',
 CONSTRAINT pga_schedule_jscminutes_size CHECK (array_upper(jscminutes, 1) = 60),
 CONSTRAINT pga_schedule_jschours_size CHECK (array_upper(jschours, 1) = 24),
 CONSTRAINT pga_schedule_jscweekdays_size CHECK (array_upper(jscweekdays, 1) = 7),
 CONSTRAINT pga_schedule_jscmonthdays_size CHECK (array_upper(jscmonthdays, 1) = 32),
-CONSTRAINT pga_schedule_jscmonths_size CHECK (array_upper(jscmonths, 1) = 12)
+CONSTRAINT pga_schedule_jscmonths_size CHECK (array_upper(jscmonths, 1) = 12),
+CONSTRAINT pga_schedule_jscseconds_size CHECK (array_upper(jscseconds, 1) = 60),
+CONSTRAINT pga_schedule_jscinterval_check CHECK (jscinterval > '0' AND date_part('MONTH', jscinterval) = 0 AND date_part('YEAR', jscinterval) = 0),
+CONSTRAINT pga_schedule_jscjitter_check CHECK (jscjitter >= '0' AND (jscinterval IS NULL OR jscjitter < jscinterval))
 ) WITHOUT OIDS;
 CREATE INDEX pga_jobschedule_jobid ON pgagent.pga_schedule(jscjobid);
 COMMENT ON TABLE pgagent.pga_schedule IS 'Schedule for a job';
+COMMENT ON COLUMN pgagent.pga_schedule.jscseconds IS 'Seconds of the minute to run at; none selected means the start of the minute';
+COMMENT ON COLUMN pgagent.pga_schedule.jscinterval IS 'If set, the job runs every jscinterval from jscstart, and the flag arrays are ignored. Months and years are not allowed, days are 24 hours';
+COMMENT ON COLUMN pgagent.pga_schedule.jscjitter IS 'Runs of an interval schedule are delayed by a random time up to jscjitter';
 
 
 
@@ -117,6 +138,27 @@ COMMENT ON TABLE pgagent.pga_schedule IS 'Job schedule exceptions';
 
 
 
+CREATE TABLE pgagent.pga_classlimit (
+clmjclid             int4                 NOT NULL PRIMARY KEY REFERENCES pgagent.pga_jobclass (jclid) ON DELETE CASCADE ON UPDATE RESTRICT,
+clmmaxrunning        int4                 NOT NULL CHECK (clmmaxrunning > 0)
+) WITHOUT OIDS;
+COMMENT ON TABLE pgagent.pga_classlimit IS 'Maximum number of jobs of a class run at the same time';
+
+
+
+CREATE TABLE pgagent.pga_targetlimit (
+tlmid                serial               NOT NULL PRIMARY KEY,
+tlmdbname            name                 NOT NULL DEFAULT '',
+tlmconnstr           text                 NOT NULL DEFAULT '',
+tlmmaxrunning        int4                 NOT NULL CHECK (tlmmaxrunning > 0)
+) WITHOUT OIDS;
+CREATE UNIQUE INDEX pga_targetlimit_target ON pgagent.pga_targetlimit (tlmdbname, tlmconnstr);
+COMMENT ON TABLE pgagent.pga_targetlimit IS 'Maximum number of jobs with SQL steps on a database run at the same time';
+COMMENT ON COLUMN pgagent.pga_targetlimit.tlmdbname IS 'Matches jstdbname of the job steps';
+COMMENT ON COLUMN pgagent.pga_targetlimit.tlmconnstr IS 'Matches jstconnstr of the job steps';
+
+
+
 CREATE TABLE pgagent.pga_joblog (
 jlgid                serial               NOT NULL PRIMARY KEY,
 jlgjobid             int4                 NOT NULL REFERENCES pgagent.pga_job (jobid) ON DELETE CASCADE ON UPDATE RESTRICT,
@@ -134,7 +176,7 @@ CREATE TABLE pgagent.pga_jobsteplog (
 jslid                serial               NOT NULL PRIMARY KEY,
 jsljlgid             int4                 NOT NULL REFERENCES pgagent.pga_joblog (jlgid) ON DELETE CASCADE ON UPDATE RESTRICT,
 jsljstid             int4                 NOT NULL REFERENCES pgagent.pga_jobstep (jstid) ON DELETE CASCADE ON UPDATE RESTRICT,
-jslstatus            char                 NOT NULL CHECK (jslstatus IN ('r', 's', 'i', 'f', 'd')) DEFAULT 'r', -- running, success, ignored, failed, aborted
+jslstatus            char                 NOT NULL CHECK (jslstatus IN ('r', 's', 'i', 'f', 'd', 't')) DEFAULT 'r', -- running, success, ignored, failed, aborted, timed out
 jslresult            int4                 NULL,
 jslstart             timestamptz          NOT NULL DEFAULT current_timestamp,
 jslduration          interval             NULL,
@@ -142,7 +184,7 @@ jsloutput            text
 ) WITHOUT OIDS;
 CREATE INDEX pga_jobsteplog_jslid ON pgagent.pga_jobsteplog(jsljlgid);
 COMMENT ON TABLE pgagent.pga_jobsteplog IS 'Job step run logs.';
-COMMENT ON COLUMN pgagent.pga_jobsteplog.jslstatus IS 'Status of job step: r=running, s=successfully finished,  f=failed stopping job, i=ignored failure, d=aborted';
+COMMENT ON COLUMN pgagent.pga_jobsteplog.jslstatus IS 'Status of job step: r=running, s=successfully finished,  f=failed stopping job, i=ignored failure, d=aborted, t=timed out';
 COMMENT ON COLUMN pgagent.pga_jobsteplog.jslresult IS 'Return code of job step';
 
 CREATE OR REPLACE FUNCTION pgagent.pgagent_schema_version() RETURNS int2 AS '
@@ -154,6 +196,20 @@ END;
 ' LANGUAGE 'plpgsql' VOLATILE;
 
 
+CREATE OR REPLACE FUNCTION pgagent.pga_flags_to_mask(bool[]) RETURNS int8 AS '
+    SELECT COALESCE(bit_or(1::int8 << (i - 1)), 0)
+      FROM generate_subscripts($1, 1) AS i
+     WHERE i BETWEEN 1 AND 63 AND $1[i]
+' LANGUAGE 'sql' IMMUTABLE;
+COMMENT ON FUNCTION pgagent.pga_flags_to_mask(bool[]) IS 'Converts a schedule flag array to a bitmask, element n being bit n - 1';
+
+
+CREATE OR REPLACE FUNCTION pgagent.pga_mask_to_flags(int8, int4) RETURNS bool[] AS '
+    SELECT ARRAY(SELECT ($1 >> (i - 1)) & 1 = 1 FROM generate_series(1, $2) AS i ORDER BY i)
+' LANGUAGE 'sql' IMMUTABLE;
+COMMENT ON FUNCTION pgagent.pga_mask_to_flags(int8, int4) IS 'Converts a schedule bitmask to a flag array of $2 elements';
+
+
 CREATE OR REPLACE FUNCTION pgagent.pga_next_schedule(int4, timestamptz, timestamptz, _bool, _bool, _bool, _bool, _bool) RETURNS timestamptz AS '
 DECLARE
     jscid           ALIAS FOR $1;
@@ -529,6 +585,151 @@ END;
 ' LANGUAGE 'plpgsql' VOLATILE;
 COMMENT ON FUNCTION pgagent.pga_next_schedule(int4, timestamptz, timestamptz, _bool, _bool, _bool, _bool, _bool) IS 'Calculates the next runtime for a given schedule';
 
+CREATE OR REPLACE FUNCTION pgagent.pga_next_schedule_mask(int4, timestamptz, timestamptz, int8, int4, int2, int8, int2) RETURNS timestamptz AS '
+    SELECT pgagent.pga_next_schedule($1, $2, $3,
+                                     pgagent.pga_mask_to_flags($4, 60), pgagent.pga_mask_to_flags($5, 24),
+                                     pgagent.pga_mask_to_flags($6, 7), pgagent.pga_mask_to_flags($7, 32),
+                                     pgagent.pga_mask_to_flags($8, 12))
+' LANGUAGE 'sql' VOLATILE;
+COMMENT ON FUNCTION pgagent.pga_next_schedule_mask(int4, timestamptz, timestamptz, int8, int4, int2, int8, int2) IS 'Calculates the next runtime for a given schedule, using the bitmask columns';
+
+
+CREATE OR REPLACE FUNCTION pgagent.pga_schedule_matches(int4, timestamptz, int8, int4, int2, int8, int2) RETURNS bool AS '
+    SELECT ($3 = 0 OR ($3 >> date_part(''MINUTE'', $2)::int4) & 1 = 1) AND
+           ($4 = 0 OR ($4 >> date_part(''HOUR'', $2)::int4) & 1 = 1) AND
+           ($5 = 0 OR ($5 >> date_part(''DOW'', $2)::int4) & 1 = 1) AND
+           ($6 = 0 OR ($6 >> (date_part(''DAY'', $2)::int4 - 1)) & 1 = 1 OR
+            ($6 = 1::int8 << 31 AND date_part(''DAY'', $2 + ''1 Day''::interval) = 1)) AND
+           ($7 = 0 OR ($7 >> (date_part(''MONTH'', $2)::int4 - 1)) & 1 = 1) AND
+           NOT EXISTS (SELECT 1 FROM pgagent.pga_exception
+                        WHERE jexscid = $1
+                          AND (jexdate IS NOT NULL OR jextime IS NOT NULL)
+                          AND (jexdate IS NULL OR jexdate = $2::date)
+                          AND (jextime IS NULL OR jextime = date_trunc(''MINUTE'', $2)::time))
+' LANGUAGE 'sql' STABLE;
+COMMENT ON FUNCTION pgagent.pga_schedule_matches(int4, timestamptz, int8, int4, int2, int8, int2) IS 'Returns TRUE if the minute of $2 is part of the schedule $1, given its bitmasks';
+
+
+CREATE OR REPLACE FUNCTION pgagent.pga_next_schedule_seconds(int4, timestamptz, timestamptz, int8, int8, int4, int2, int8, int2) RETURNS timestamptz AS '
+DECLARE
+    jscid           ALIAS FOR $1;
+    jscstart        ALIAS FOR $2;
+    jscend          ALIAS FOR $3;
+    jscsecondmask   ALIAS FOR $4;
+
+    thisminute      timestamptz := date_trunc(''MINUTE'', now());
+    nextrun         timestamptz;
+    s               int4;
+
+BEGIN
+    -- No second selected means the start of the minute, as it always did
+    IF jscsecondmask = 0 THEN
+        RETURN pgagent.pga_next_schedule_mask(jscid, jscstart, jscend, $5, $6, $7, $8, $9);
+    END IF;
+
+    -- The next selected second of the current minute, if the schedule
+    -- includes that minute.
+    IF jscstart IS NOT NULL AND thisminute >= date_trunc(''MINUTE'', jscstart) AND
+       pgagent.pga_schedule_matches(jscid, thisminute, $5, $6, $7, $8, $9) THEN
+        FOR s IN (floor(date_part(''SECOND'', now()))::int4 + 1) .. 59 LOOP
+            nextrun := thisminute + s * ''1 Second''::interval;
+            IF (jscsecondmask >> s) & 1 = 1 AND nextrun >= jscstart THEN
+                IF nextrun > jscend THEN
+                    RETURN NULL;
+                END IF;
+                RETURN nextrun;
+            END IF;
+        END LOOP;
+    END IF;
+
+    -- Otherwise, the first selected second of the next minute to run in
+    nextrun := pgagent.pga_next_schedule_mask(jscid, jscstart, jscend, $5, $6, $7, $8, $9);
+    IF nextrun IS NULL THEN
+        RETURN NULL;
+    END IF;
+
+    FOR s IN 0 .. 59 LOOP
+        IF (jscsecondmask >> s) & 1 = 1 THEN
+            nextrun := nextrun + s * ''1 Second''::interval;
+            EXIT;
+        END IF;
+    END LOOP;
+
+    IF nextrun > jscend THEN
+        RETURN NULL;
+    END IF;
+    RETURN nextrun;
+END;
+' LANGUAGE 'plpgsql' VOLATILE;
+COMMENT ON FUNCTION pgagent.pga_next_schedule_seconds(int4, timestamptz, timestamptz, int8, int8, int4, int2, int8, int2) IS 'Calculates the next runtime for a given schedule, to the second';
+
+
+CREATE OR REPLACE FUNCTION pgagent.pga_next_interval(int4, timestamptz, timestamptz, interval, interval) RETURNS timestamptz AS '
+DECLARE
+    jscid           ALIAS FOR $1;
+    jscstart        ALIAS FOR $2;
+    jscend          ALIAS FOR $3;
+    jscinterval     ALIAS FOR $4;
+    jscjitter       ALIAS FOR $5;
+
+    period          float8 := extract(EPOCH FROM jscinterval);
+    runafter        timestamptz := now();
+    nextrun         timestamptz;
+
+BEGIN
+    -- No valid start date or period has been specified
+    IF jscstart IS NULL OR NOT period > 0 THEN RETURN NULL; END IF;
+
+    -- The schedule is past its end date
+    IF jscend IS NOT NULL AND jscend < now() THEN RETURN NULL; END IF;
+
+    LOOP
+        -- The first run after runafter, counting whole periods from the start
+        -- date. Runs missed while the job was late or running are skipped.
+        IF runafter < jscstart THEN
+            nextrun := jscstart;
+        ELSE
+            nextrun := jscstart + (floor(extract(EPOCH FROM runafter - jscstart) / period) + 1) * period * ''1 Second''::interval;
+        END IF;
+
+        IF EXISTS (SELECT 1 FROM pgagent.pga_exception WHERE jexscid = jscid AND jexdate = nextrun::date AND jextime IS NULL) THEN
+            -- Skip the whole day
+            runafter := date_trunc(''DAY'', nextrun) + ''1 Day''::interval - ''1 Microsecond''::interval;
+        ELSIF EXISTS (SELECT 1 FROM pgagent.pga_exception WHERE jexscid = jscid AND (jexdate IS NULL OR jexdate = nextrun::date) AND jextime = date_trunc(''MINUTE'', nextrun)::time) THEN
+            runafter := nextrun;
+        ELSE
+            EXIT;
+        END IF;
+    END LOOP;
+
+    -- If the result is past the end date, exit.
+    IF nextrun > jscend THEN
+        RETURN NULL;
+    END IF;
+
+    -- The delay must not take the run past the end date either
+    RETURN LEAST(nextrun + random() * jscjitter, jscend);
+END;
+' LANGUAGE 'plpgsql' VOLATILE;
+COMMENT ON FUNCTION pgagent.pga_next_interval(int4, timestamptz, timestamptz, interval, interval) IS 'Calculates the next runtime for a schedule running every $4 from $2, delayed by up to $5 at random';
+
+-- Replace the functions above with the native implementations from the
+-- pgaschedule module, if it has been installed. The semantics are identical;
+-- the SQL versions are left in place if the module cannot be loaded.
+DO '
+BEGIN
+    CREATE OR REPLACE FUNCTION pgagent.pga_next_schedule(int4, timestamptz, timestamptz, _bool, _bool, _bool, _bool, _bool) RETURNS timestamptz
+      AS ''$libdir/pgaschedule'', ''pga_next_schedule'' LANGUAGE C VOLATILE;
+    COMMENT ON FUNCTION pgagent.pga_next_schedule(int4, timestamptz, timestamptz, _bool, _bool, _bool, _bool, _bool) IS ''Calculates the next runtime for a given schedule'';
+    CREATE OR REPLACE FUNCTION pgagent.pga_next_schedule_mask(int4, timestamptz, timestamptz, int8, int4, int2, int8, int2) RETURNS timestamptz
+      AS ''$libdir/pgaschedule'', ''pga_next_schedule_mask'' LANGUAGE C VOLATILE;
+    COMMENT ON FUNCTION pgagent.pga_next_schedule_mask(int4, timestamptz, timestamptz, int8, int4, int2, int8, int2) IS ''Calculates the next runtime for a given schedule, using the bitmask columns'';
+EXCEPTION
+    WHEN undefined_file OR undefined_function OR insufficient_privilege THEN
+        RAISE NOTICE ''pgaschedule module not available, using the SQL implementations of the schedule functions'';
+END;
+' LANGUAGE 'plpgsql';
+
 
 
 --
@@ -570,7 +771,10 @@ BEGIN
     IF NEW.jobenabled THEN
         IF NEW.jobnextrun IS NULL THEN
              SELECT INTO NEW.jobnextrun
-                    MIN(pgagent.pga_next_schedule(jscid, jscstart, jscend, jscminutes, jschours, jscweekdays, jscmonthdays, jscmonths))
+                    MIN(CASE WHEN jscinterval IS NULL
+                             THEN pgagent.pga_next_schedule_seconds(jscid, jscstart, jscend, jscsecondmask, jscminutemask, jschourmask, jscweekdaymask, jscmonthdaymask, jscmonthmask)
+                             ELSE pgagent.pga_next_interval(jscid, jscstart, jscend, jscinterval, jscjitter)
+                        END)
                FROM pgagent.pga_schedule
               WHERE jscenabled AND jscjobid=OLD.jobid;
         END IF;
@@ -616,6 +820,57 @@ CREATE TRIGGER pga_schedule_trigger AFTER INSERT OR UPDATE OR DELETE
 COMMENT ON TRIGGER pga_schedule_trigger ON pgagent.pga_schedule IS 'Update the job''s next run time whenever a schedule changes';
 
 
+CREATE OR REPLACE FUNCTION pgagent.pga_schedule_mask_trigger() RETURNS trigger AS '
+BEGIN
+    -- pgAdmin reads and writes the flag arrays, whereas the next run time is
+    -- calculated from the bitmasks. Keep both in step: a mask that is set on
+    -- its own is copied to the array, otherwise the array wins.
+    IF (TG_OP = ''INSERT'' AND NEW.jscsecondmask <> 0 AND NOT (TRUE = ANY (NEW.jscseconds))) OR
+       (TG_OP = ''UPDATE'' AND NEW.jscseconds = OLD.jscseconds AND NEW.jscsecondmask <> OLD.jscsecondmask) THEN
+        NEW.jscseconds := pgagent.pga_mask_to_flags(NEW.jscsecondmask, 60);
+    END IF;
+    NEW.jscsecondmask := pgagent.pga_flags_to_mask(NEW.jscseconds);
+
+    IF (TG_OP = ''INSERT'' AND NEW.jscminutemask <> 0 AND NOT (TRUE = ANY (NEW.jscminutes))) OR
+       (TG_OP = ''UPDATE'' AND NEW.jscminutes = OLD.jscminutes AND NEW.jscminutemask <> OLD.jscminutemask) THEN
+        NEW.jscminutes := pgagent.pga_mask_to_flags(NEW.jscminutemask, 60);
+    END IF;
+    NEW.jscminutemask := pgagent.pga_flags_to_mask(NEW.jscminutes);
+
+    IF (TG_OP = ''INSERT'' AND NEW.jschourmask <> 0 AND NOT (TRUE = ANY (NEW.jschours))) OR
+       (TG_OP = ''UPDATE'' AND NEW.jschours = OLD.jschours AND NEW.jschourmask <> OLD.jschourmask) THEN
+        NEW.jschours := pgagent.pga_mask_to_flags(NEW.jschourmask, 24);
+    END IF;
+    NEW.jschourmask := pgagent.pga_flags_to_mask(NEW.jschours);
+
+    IF (TG_OP = ''INSERT'' AND NEW.jscweekdaymask <> 0 AND NOT (TRUE = ANY (NEW.jscweekdays))) OR
+       (TG_OP = ''UPDATE'' AND NEW.jscweekdays = OLD.jscweekdays AND NEW.jscweekdaymask <> OLD.jscweekdaymask) THEN
+        NEW.jscweekdays := pgagent.pga_mask_to_flags(NEW.jscweekdaymask, 7);
+    END IF;
+    NEW.jscweekdaymask := pgagent.pga_flags_to_mask(NEW.jscweekdays);
+
+    IF (TG_OP = ''INSERT'' AND NEW.jscmonthdaymask <> 0 AND NOT (TRUE = ANY (NEW.jscmonthdays))) OR
+       (TG_OP = ''UPDATE'' AND NEW.jscmonthdays = OLD.jscmonthdays AND NEW.jscmonthdaymask <> OLD.jscmonthdaymask) THEN
+        NEW.jscmonthdays := pgagent.pga_mask_to_flags(NEW.jscmonthdaymask, 32);
+    END IF;
+    NEW.jscmonthdaymask := pgagent.pga_flags_to_mask(NEW.jscmonthdays);
+
+    IF (TG_OP = ''INSERT'' AND NEW.jscmonthmask <> 0 AND NOT (TRUE = ANY (NEW.jscmonths))) OR
+       (TG_OP = ''UPDATE'' AND NEW.jscmonths = OLD.jscmonths AND NEW.jscmonthmask <> OLD.jscmonthmask) THEN
+        NEW.jscmonths := pgagent.pga_mask_to_flags(NEW.jscmonthmask, 12);
+    END IF;
+    NEW.jscmonthmask := pgagent.pga_flags_to_mask(NEW.jscmonths);
+    RETURN NEW;
+END;
+' LANGUAGE 'plpgsql';
+COMMENT ON FUNCTION pgagent.pga_schedule_mask_trigger() IS 'Keep the schedule flag arrays and bitmasks in step';
+
+CREATE TRIGGER pga_schedule_mask_trigger BEFORE INSERT OR UPDATE
+   ON pgagent.pga_schedule FOR EACH ROW
+   EXECUTE PROCEDURE pgagent.pga_schedule_mask_trigger();
+COMMENT ON TRIGGER pga_schedule_mask_trigger ON pgagent.pga_schedule IS 'Keep the schedule flag arrays and bitmasks in step';
+
+
 CREATE OR REPLACE FUNCTION pgagent.pga_exception_trigger() RETURNS "trigger" AS '
 DECLARE
 
@@ -653,6 +908,190 @@ CREATE TRIGGER pga_exception_trigger AFTER INSERT OR UPDATE OR DELETE
   EXECUTE PROCEDURE pgagent.pga_exception_trigger();
 COMMENT ON TRIGGER pga_exception_trigger ON pgagent.pga_exception IS 'Update the job''s next run time whenever an exception changes';
 
+
+CREATE OR REPLACE FUNCTION pgagent.pga_job_notify_trigger() RETURNS trigger AS '
+BEGIN
+    -- Wake up the agents listening on the pgagent_job channel. Changes to
+    -- schedules and exceptions reach this trigger through the pga_job update
+    -- performed by their own triggers. Updates made while an agent owns the
+    -- job (i.e. claiming it) are not interesting to anyone else.
+    IF TG_OP = ''DELETE'' THEN
+        PERFORM pg_notify(''pgagent_job'', OLD.jobid::text);
+        RETURN OLD;
+    END IF;
+
+    IF NEW.jobagentid IS NULL THEN
+        PERFORM pg_notify(''pgagent_job'', NEW.jobid::text);
+    END IF;
+    RETURN NEW;
+END;
+' LANGUAGE 'plpgsql' VOLATILE;
+COMMENT ON FUNCTION pgagent.pga_job_notify_trigger() IS 'Notify the agents whenever a job or its next run time changes';
+
+CREATE TRIGGER pga_job_notify_trigger AFTER INSERT OR UPDATE OR DELETE
+  ON pgagent.pga_job FOR EACH ROW
+  EXECUTE PROCEDURE pgagent.pga_job_notify_trigger();
+COMMENT ON TRIGGER pga_job_notify_trigger ON pgagent.pga_job IS 'Notify the agents whenever a job or its next run time changes';
+
+
+CREATE OR REPLACE FUNCTION pgagent.pga_runnable_jobs(text) RETURNS TABLE(jobid int4, jobpriority int2, jobrank int8) AS '
+    WITH RECURSIVE due AS (
+        SELECT J.jobid, J.jobjclid, J.jobpriority,
+               row_number() OVER (ORDER BY J.jobpriority DESC, J.jobnextrun, J.jobid) AS jobrank
+          FROM pgagent.pga_job J
+         WHERE J.jobenabled
+           AND J.jobagentid IS NULL
+           AND J.jobnextrun <= now()
+           AND (J.jobhostagent = '''' OR J.jobhostagent = $1)
+    ),
+    running AS (
+        SELECT J.jobid, J.jobjclid
+          FROM pgagent.pga_job J
+         WHERE J.jobagentid IS NOT NULL
+    ),
+    targets AS (
+        SELECT DISTINCT S.jstjobid AS jobid, L.tlmid, L.tlmmaxrunning
+          FROM pgagent.pga_jobstep S
+          JOIN pgagent.pga_targetlimit L ON L.tlmdbname = S.jstdbname AND L.tlmconnstr = S.jstconnstr
+         WHERE S.jstenabled
+           AND S.jstkind = ''s''
+           AND S.jstjobid IN (SELECT D.jobid FROM due D UNION ALL SELECT R.jobid FROM running R)
+    ),
+    -- Take the due jobs one at a time, in the order they would be started,
+    -- keeping those which fit within the limits on top of the running jobs
+    -- and the ones kept so far, so that claiming several jobs at once cannot
+    -- go over a limit either. A job held back by one limit doesn't count
+    -- against the other, and so doesn't hold back the jobs behind it.
+    kept(jobrank, jobids) AS (
+        SELECT 0::int8, ''{}''::int4[]
+        UNION ALL
+        SELECT D.jobrank,
+               CASE WHEN NOT EXISTS (
+                             SELECT 1 FROM pgagent.pga_classlimit C
+                              WHERE C.clmjclid = D.jobjclid
+                                AND (SELECT count(*) FROM running R WHERE R.jobjclid = D.jobjclid) +
+                                    (SELECT count(*) FROM due KD WHERE KD.jobjclid = D.jobjclid AND KD.jobid = ANY(K.jobids)) >= C.clmmaxrunning)
+                     AND NOT EXISTS (
+                             SELECT 1 FROM targets T
+                              WHERE T.jobid = D.jobid
+                                AND (SELECT count(*) FROM running R JOIN targets RT ON RT.jobid = R.jobid WHERE RT.tlmid = T.tlmid) +
+                                    (SELECT count(*) FROM targets KT WHERE KT.tlmid = T.tlmid AND KT.jobid = ANY(K.jobids)) >= T.tlmmaxrunning)
+                    THEN K.jobids || D.jobid
+                    ELSE K.jobids
+               END
+          FROM kept K
+          JOIN due D ON D.jobrank = K.jobrank + 1
+    )
+    SELECT D.jobid, D.jobpriority, D.jobrank
+      FROM due D
+     WHERE D.jobid = ANY((SELECT K.jobids FROM kept K ORDER BY K.jobrank DESC LIMIT 1))
+' LANGUAGE 'sql' STABLE;
+COMMENT ON FUNCTION pgagent.pga_runnable_jobs(text) IS 'Jobs due on host $1 which can be started within the concurrency limits, in the order they should be: by priority, then by lateness';
+
+
+CREATE OR REPLACE FUNCTION pgagent.pga_claim_jobs(int4, text, int4, int4) RETURNS TABLE(jobid int4, logid int4, jobpriority int2) AS '
+DECLARE
+    agentid         ALIAS FOR $1;
+    hostname        ALIAS FOR $2;
+    maxjobs         ALIAS FOR $3;
+    maxlowpriority  ALIAS FOR $4;
+
+    skiplocked      text := '''';
+
+BEGIN
+    -- The concurrency limits apply to the jobs of all the agents, so they
+    -- have to take turns while any is set. Each statement below takes a new
+    -- snapshot, and so sees what the previous agent has claimed.
+    IF EXISTS (SELECT 1 FROM pgagent.pga_classlimit) OR EXISTS (SELECT 1 FROM pgagent.pga_targetlimit) THEN
+        PERFORM pg_advisory_xact_lock(hashtext(''pgagent.pga_claim_jobs''));
+    END IF;
+
+    -- Jobs locked by an agent claiming them right now are skipped, rather
+    -- than waited for.
+    IF current_setting(''server_version_num'')::int4 >= 90500 THEN
+        skiplocked := '' SKIP LOCKED'';
+    END IF;
+
+    -- Only the jobs with a priority above 0 may take the last maxjobs -
+    -- maxlowpriority jobs, which are kept for them.
+    RETURN QUERY EXECUTE
+        ''WITH due AS ('' ||
+        ''    SELECT J.jobid, R.jobrank FROM pgagent.pga_job J'' ||
+        ''      JOIN (SELECT R.*, row_number() OVER (PARTITION BY R.jobpriority > 0 ORDER BY R.jobrank) AS grouprank'' ||
+        ''              FROM pgagent.pga_runnable_jobs($2) R) R ON R.jobid = J.jobid'' ||
+        ''     WHERE R.jobpriority > 0 OR R.grouprank <= $4'' ||
+        ''     ORDER BY R.jobrank LIMIT $3 FOR UPDATE OF J'' || skiplocked ||
+        ''), claimed AS ('' ||
+        ''    UPDATE pgagent.pga_job J SET jobagentid = $1, joblastrun = now()'' ||
+        ''      FROM due WHERE J.jobid = due.jobid AND J.jobagentid IS NULL'' ||
+        ''    RETURNING J.jobid, J.jobpriority, due.jobrank'' ||
+        ''), logged AS ('' ||
+        ''    INSERT INTO pgagent.pga_joblog (jlgjobid) SELECT jobid FROM claimed'' ||
+        ''    RETURNING jlgjobid, jlgid'' ||
+        '') '' ||
+        ''SELECT C.jobid, L.jlgid, C.jobpriority FROM claimed C JOIN logged L ON L.jlgjobid = C.jobid ORDER BY C.jobrank''
+        USING agentid, hostname, maxjobs, maxlowpriority;
+END;
+' LANGUAGE 'plpgsql' VOLATILE;
+COMMENT ON FUNCTION pgagent.pga_claim_jobs(int4, text, int4, int4) IS 'Claims up to $3 runnable jobs on host $2 for agent $1, no more than $4 of them with a priority of 0 or less, and creates their job log entries';
+
+CREATE OR REPLACE FUNCTION pgagent.pga_job_steps(int4) RETURNS TABLE(jstid int4, jstkind char, jstcode text, jstdbname name, jstconnstr text, jstonerror char, timeout int8) AS '
+SELECT S.jstid, S.jstkind, S.jstcode, S.jstdbname, S.jstconnstr, S.jstonerror,
+       CEIL(EXTRACT(EPOCH FROM COALESCE(S.jsttimeout, J.jobsteptimeout)) * 1000)::int8
+  FROM pgagent.pga_jobstep S
+  JOIN pgagent.pga_job J ON J.jobid = S.jstjobid
+ WHERE S.jstenabled
+   AND S.jstjobid = $1
+ ORDER BY S.jstname, S.jstid
+' LANGUAGE 'sql' STABLE;
+COMMENT ON FUNCTION pgagent.pga_job_steps(int4) IS 'The enabled steps of job $1, in the order they are run, with their time limit in milliseconds';
+
+CREATE OR REPLACE FUNCTION pgagent.pga_step_begin(int4, int4) RETURNS int4 AS '
+INSERT INTO pgagent.pga_jobsteplog (jsljlgid, jsljstid, jslstatus)
+SELECT $1, jstid, ''r''
+  FROM pgagent.pga_jobstep
+ WHERE jstid = $2
+RETURNING jslid
+' LANGUAGE 'sql' VOLATILE;
+COMMENT ON FUNCTION pgagent.pga_step_begin(int4, int4) IS 'Creates the log entry of step $2 in the run logged as $1, and returns its id, or NULL if the step does not exist any more';
+
+CREATE OR REPLACE FUNCTION pgagent.pga_step_end(int4, int4, char, text) RETURNS bool AS '
+DECLARE
+    slid    ALIAS FOR $1;
+    result  ALIAS FOR $2;
+    status  ALIAS FOR $3;
+    output  ALIAS FOR $4;
+BEGIN
+    UPDATE pgagent.pga_jobsteplog
+       SET jslduration = now() - jslstart,
+           jslresult = result, jslstatus = status, jsloutput = output
+     WHERE jslid = slid;
+
+    RETURN FOUND;
+END;
+' LANGUAGE 'plpgsql' VOLATILE;
+COMMENT ON FUNCTION pgagent.pga_step_end(int4, int4, char, text) IS 'Records the end of the step logged as $1, with its result $2, status $3 and output $4. Returns false if the log entry does not exist any more';
+
+CREATE OR REPLACE FUNCTION pgagent.pga_job_end(int4, int4, char) RETURNS bool AS '
+DECLARE
+    id      ALIAS FOR $1;
+    logid   ALIAS FOR $2;
+    status  ALIAS FOR $3;
+BEGIN
+    -- Giving the job back gets its next run time computed
+    UPDATE pgagent.pga_job
+       SET jobagentid = NULL, jobnextrun = NULL
+     WHERE jobid = id;
+
+    UPDATE pgagent.pga_joblog
+       SET jlgstatus = status, jlgduration = now() - jlgstart
+     WHERE jlgid = logid;
+
+    RETURN FOUND;
+END;
+' LANGUAGE 'plpgsql' VOLATILE;
+COMMENT ON FUNCTION pgagent.pga_job_end(int4, int4, char) IS 'Records the end of the run of job $1 logged as $2, with status $3, and gives the job back. Returns false if the log entry does not exist any more';
+
 -- Extension dump support.
 -- EXT SELECT pg_catalog.pg_extension_config_dump('pga_jobagent', '');
 -- EXT SELECT pg_catalog.pg_extension_config_dump('pga_jobclass', $$WHERE jclname NOT IN ('Routine Maintenance', 'Data Import', 'Data Export', 'Data Summarisation', 'Miscellaneous')$$);
@@ -660,6 +1099,8 @@ COMMENT ON TRIGGER pga_exception_trigger ON pgagent.pga_exception IS 'Update the
 -- EXT SELECT pg_catalog.pg_extension_config_dump('pga_jobstep', '');
 -- EXT SELECT pg_catalog.pg_extension_config_dump('pga_schedule', '');
 -- EXT SELECT pg_catalog.pg_extension_config_dump('pga_exception', '');
+-- EXT SELECT pg_catalog.pg_extension_config_dump('pga_classlimit', '');
+-- EXT SELECT pg_catalog.pg_extension_config_dump('pga_targetlimit', '');
 -- EXT SELECT pg_catalog.pg_extension_config_dump('pga_joblog', '');
 -- EXT SELECT pg_catalog.pg_extension_config_dump('pga_jobsteplog', '');
 
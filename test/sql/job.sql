@@ -14,5 +14,24 @@ WITH
 INSERT INTO pgagent.pga_schedule (jscjobid, jscname, jscdesc, jscminutes, jschours, jscweekdays, jscmonthdays, jscmonths, jscenabled, jscstart, jscend)
  SELECT id.jobid, 'schedule1', '', '{t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t}', '{t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t}', '{t,t,t,t,t,t,t}', '{t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t}', '{t,t,t,t,t,t,t,t,t,t,t,t}', true, '2000-01-01 00:00:00', '2099-12-31 00:00:00'
   FROM id;
+WITH
+ id AS
+ (INSERT INTO pgagent.pga_job (jobjclid, jobname, jobdesc, jobenabled, jobhostagent, jobsteptimeout)
+  SELECT jcl.jclid, 'timeoutjob', '', true, '', '1 second'
+   FROM pgagent.pga_jobclass jcl WHERE jclname='Routine Maintenance'
+  RETURNING jobid),
+ insertstep AS
+ (INSERT INTO pgagent.pga_jobstep (jstjobid, jstname, jstdesc, jstenabled, jstkind, jstonerror, jstcode, jstdbname, jstconnstr)
+  SELECT id.jobid, 'slowstep', '', true, 's', 'i', 'SELECT pg_sleep(60)', 'contrib_regression', ''
+   FROM id)
+INSERT INTO pgagent.pga_schedule (jscjobid, jscname, jscdesc, jscminutes, jschours, jscweekdays, jscmonthdays, jscmonths, jscenabled, jscstart, jscend)
+ SELECT id.jobid, 'timeoutschedule', '', '{t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t}', '{t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t}', '{t,t,t,t,t,t,t}', '{t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t,t}', '{t,t,t,t,t,t,t,t,t,t,t,t}', true, '2000-01-01 00:00:00', '2099-12-31 00:00:00'
+  FROM id;
 \! ( pgagent -f -l 2 -s pgagent.out "user=$PGUSER dbname=contrib_regression" ) & sleep 80; kill $! 2> /dev/null || :
 SELECT count(*) > 0 AS job_run FROM t;
+SELECT count(*) > 0 AND bool_and(l.jslstatus = 't') AS step_timed_out
+  FROM pgagent.pga_jobsteplog l
+  JOIN pgagent.pga_jobstep s ON s.jstid = l.jsljstid
+ WHERE s.jstname = 'slowstep' AND l.jslstatus <> 'r';
+-- The timeout job is not wanted by the tests which follow
+DELETE FROM pgagent.pga_job WHERE jobname='timeoutjob';
@@ -0,0 +1,73 @@
+-- Concurrency limits of the job classes and target databases, as applied by
+-- pga_runnable_jobs() and pga_claim_jobs().
+UPDATE pgagent.pga_job SET jobenabled=false WHERE jobname='job1';
+INSERT INTO pgagent.pga_jobclass (jclname) VALUES ('Limited');
+INSERT INTO pgagent.pga_job (jobjclid, jobname, jobdesc, jobenabled, jobhostagent, jobnextrun)
+ SELECT jcl.jclid, j.name, '', true, '', now() - j.late
+  FROM pgagent.pga_jobclass jcl,
+       (VALUES ('limita', interval '3 minutes'), ('limitb', interval '2 minutes'), ('limitc', interval '1 minute')) j(name, late)
+ WHERE jclname='Limited';
+INSERT INTO pgagent.pga_jobstep (jstjobid, jstname, jstdesc, jstenabled, jstkind, jstonerror, jstcode, jstdbname, jstconnstr)
+ SELECT jobid, 'step1', '', true, 's', 'f', 'SELECT 1', 'limited_db', ''
+  FROM pgagent.pga_job WHERE jobname IN ('limita', 'limitb', 'limitc');
+CREATE FUNCTION runnable(text) RETURNS text AS $$
+ SELECT string_agg(J.jobname, ', ' ORDER BY R.jobrank)
+  FROM pgagent.pga_runnable_jobs('') R JOIN pgagent.pga_job J ON J.jobid = R.jobid
+ WHERE J.jobname LIKE $1
+$$ LANGUAGE sql;
+-- No limits
+SELECT runnable('limit%');
+-- One job of the class at a time
+INSERT INTO pgagent.pga_classlimit (clmjclid, clmmaxrunning)
+ SELECT jclid, 1 FROM pgagent.pga_jobclass WHERE jclname='Limited';
+SELECT runnable('limit%');
+UPDATE pgagent.pga_classlimit SET clmmaxrunning=2;
+SELECT runnable('limit%');
+-- Running jobs count against the limit
+INSERT INTO pgagent.pga_jobagent (jagpid, jagstation) VALUES (pg_backend_pid(), 'regression');
+UPDATE pgagent.pga_job SET jobagentid=pg_backend_pid() WHERE jobname='limita';
+SELECT runnable('limit%');
+-- One job on the target database at a time
+UPDATE pgagent.pga_classlimit SET clmmaxrunning=10;
+INSERT INTO pgagent.pga_targetlimit (tlmdbname, tlmmaxrunning) VALUES ('limited_db', 2);
+SELECT runnable('limit%');
+UPDATE pgagent.pga_targetlimit SET tlmmaxrunning=1;
+SELECT runnable('limit%');
+-- Claim the jobs which can be run
+UPDATE pgagent.pga_targetlimit SET tlmmaxrunning=2;
+SELECT J.jobname, C.logid IS NOT NULL AS logged
+  FROM pgagent.pga_claim_jobs(pg_backend_pid(), '', 10, 10) C
+  JOIN pgagent.pga_job J ON J.jobid = C.jobid
+ WHERE J.jobname LIKE 'limit%';
+SELECT runnable('limit%');
+-- Higher priorities first, then the most late
+INSERT INTO pgagent.pga_job (jobjclid, jobname, jobdesc, jobenabled, jobhostagent, jobnextrun, jobpriority)
+ SELECT jcl.jclid, j.name, '', true, '', now() - j.late, j.priority
+  FROM pgagent.pga_jobclass jcl,
+       (VALUES ('prioa', interval '3 minutes', 0), ('priob', interval '2 minutes', 5),
+               ('prioc', interval '1 minute', 0), ('priod', interval '4 minutes', -1)) j(name, late, priority)
+ WHERE jclname='Miscellaneous';
+SELECT runnable('prio%');
+-- Only one job with a priority of 0 or less
+SELECT J.jobname, C.jobpriority
+  FROM pgagent.pga_claim_jobs(pg_backend_pid(), '', 10, 1) C
+  JOIN pgagent.pga_job J ON J.jobid = C.jobid
+ WHERE J.jobname LIKE 'prio%'
+ ORDER BY C.jobpriority DESC;
+SELECT runnable('prio%');
+-- A job held back by one limit doesn't hold back the jobs behind it
+INSERT INTO pgagent.pga_jobclass (jclname) VALUES ('Capped');
+INSERT INTO pgagent.pga_classlimit (clmjclid, clmmaxrunning)
+ SELECT jclid, 1 FROM pgagent.pga_jobclass WHERE jclname='Capped';
+INSERT INTO pgagent.pga_job (jobjclid, jobname, jobdesc, jobenabled, jobhostagent, jobnextrun, jobagentid)
+ SELECT jcl.jclid, j.name, '', true, '', now() - j.late, j.agent
+  FROM pgagent.pga_jobclass jcl,
+       (VALUES ('Capped', 'holda', interval '4 minutes', pg_backend_pid()),
+               ('Capped', 'holdb', interval '3 minutes', NULL),
+               ('Miscellaneous', 'holdc', interval '2 minutes', NULL)) j(class, name, late, agent)
+ WHERE jcl.jclname = j.class;
+INSERT INTO pgagent.pga_jobstep (jstjobid, jstname, jstdesc, jstenabled, jstkind, jstonerror, jstcode, jstdbname, jstconnstr)
+ SELECT jobid, 'step1', '', true, 's', 'f', 'SELECT 1', 'shared_db', ''
+  FROM pgagent.pga_job WHERE jobname IN ('holdb', 'holdc');
+INSERT INTO pgagent.pga_targetlimit (tlmdbname, tlmmaxrunning) VALUES ('shared_db', 1);
+SELECT runnable('hold%');
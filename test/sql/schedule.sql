@@ -0,0 +1,59 @@
+-- pga_next_schedule() is either the native implementation from the pgaschedule
+-- module or the PL/pgSQL fallback; both must give the same results. Use start
+-- dates in the future so the results do not depend on the current time.
+INSERT INTO pgagent.pga_job (jobjclid, jobname, jobdesc, jobenabled, jobhostagent)
+ SELECT jcl.jclid, 'job2', '', false, ''
+  FROM pgagent.pga_jobclass jcl WHERE jclname='Routine Maintenance';
+INSERT INTO pgagent.pga_schedule (jscjobid, jscname, jscdesc, jscminutes, jschours, jscweekdays, jscmonthdays, jscmonths, jscenabled, jscstart)
+ SELECT jobid, 'schedule2', '', '{t,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,t,t,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f}', true, '2090-01-15 10:17:30'
+  FROM pgagent.pga_job WHERE jobname='job2';
+CREATE FUNCTION next_run(_bool, _bool, _bool, _bool, _bool, timestamptz DEFAULT '2090-01-15 10:17:30') RETURNS text AS $$
+ SELECT to_char(pgagent.pga_next_schedule(jscid, $6, NULL, $1, $2, $3, $4, $5), 'YYYY-MM-DD HH24:MI')
+  FROM pgagent.pga_schedule WHERE jscname='schedule2'
+$$ LANGUAGE sql;
+-- No flags at all
+SELECT next_run('{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f}');
+-- Wrap into the next hour
+SELECT next_run('{f,f,f,f,f,t,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f}');
+-- Last day of the month
+SELECT next_run('{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,t}', '{f,f,f,f,f,f,f,f,f,f,f,f}', '2090-02-10 08:00');
+-- Weekday
+SELECT next_run('{t,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,t,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,t,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f}');
+-- Exceptions
+INSERT INTO pgagent.pga_exception (jexscid, jexdate, jextime)
+ SELECT jscid, NULL, '11:00' FROM pgagent.pga_schedule WHERE jscname='schedule2';
+SELECT next_run('{t,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,t,t,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f}');
+INSERT INTO pgagent.pga_exception (jexscid, jexdate, jextime)
+ SELECT jscid, '2090-01-15', NULL FROM pgagent.pga_schedule WHERE jscname='schedule2';
+SELECT next_run('{t,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,t,t,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f,f}', '{f,f,f,f,f,f,f,f,f,f,f,f}');
+-- Bitmasks
+SELECT jscminutemask, jschourmask, jscweekdaymask, jscmonthdaymask, jscmonthmask
+  FROM pgagent.pga_schedule WHERE jscname='schedule2';
+UPDATE pgagent.pga_schedule SET jscweekdaymask = 8 WHERE jscname='schedule2';
+SELECT jscweekdays FROM pgagent.pga_schedule WHERE jscname='schedule2';
+SELECT to_char(pgagent.pga_next_schedule_mask(jscid, jscstart, jscend, jscminutemask, jschourmask, jscweekdaymask, jscmonthdaymask, jscmonthmask), 'YYYY-MM-DD HH24:MI') AS next_run
+  FROM pgagent.pga_schedule WHERE jscname='schedule2';
+-- Seconds
+UPDATE pgagent.pga_schedule SET jscsecondmask = (1 << 15) | (1 << 45) WHERE jscname='schedule2';
+SELECT jscseconds FROM pgagent.pga_schedule WHERE jscname='schedule2';
+SELECT to_char(pgagent.pga_next_schedule_seconds(jscid, jscstart, jscend, jscsecondmask, jscminutemask, jschourmask, jscweekdaymask, jscmonthdaymask, jscmonthmask), 'YYYY-MM-DD HH24:MI:SS') AS next_run
+  FROM pgagent.pga_schedule WHERE jscname='schedule2';
+SELECT v.ts, pgagent.pga_schedule_matches(S.jscid, v.ts::timestamptz, S.jscminutemask, S.jschourmask, S.jscweekdaymask, S.jscmonthdaymask, S.jscmonthmask) AS matches
+  FROM pgagent.pga_schedule S,
+       (VALUES ('2090-01-18 12:00:40'), ('2090-01-18 11:00:40'), ('2090-01-18 12:01:40'), ('2090-01-19 12:00:40')) v(ts)
+ WHERE S.jscname='schedule2'
+ ORDER BY v.ts;
+-- Intervals
+SELECT to_char(pgagent.pga_next_interval(0, '2090-01-15 10:17:30', NULL, '15 seconds', '0'), 'YYYY-MM-DD HH24:MI:SS') AS next_run;
+SELECT next_run > now() AND next_run <= now() + '15 minutes'::interval AND
+       extract(EPOCH FROM next_run - '2000-01-01 00:00:07'::timestamptz)::numeric % 900 = 0 AS on_period
+  FROM pgagent.pga_next_interval(0, '2000-01-01 00:00:07', NULL, '15 minutes', '0') next_run;
+SELECT next_run BETWEEN '2090-01-15 10:17:30' AND '2090-01-15 10:17:40' AS jittered
+  FROM pgagent.pga_next_interval(0, '2090-01-15 10:17:30', NULL, '15 seconds', '10 seconds') next_run;
+SELECT pgagent.pga_next_interval(0, '2000-01-01 00:00:00', '2000-01-02 00:00:00', '15 minutes', '0') IS NULL AS ended;
+SELECT next_run BETWEEN '2090-01-15 10:17:30' AND '2090-01-15 10:17:35' AS before_end
+  FROM pgagent.pga_next_interval(0, '2090-01-15 10:17:30', '2090-01-15 10:17:35', '15 seconds', '1 hour') next_run;
+SELECT to_char(pgagent.pga_next_interval(jscid, '2090-01-15 10:17:30', NULL, '1 hour', '0'), 'YYYY-MM-DD HH24:MI:SS') AS next_run
+  FROM pgagent.pga_schedule WHERE jscname='schedule2';
+DROP FUNCTION next_run(_bool, _bool, _bool, _bool, _bool, timestamptz);
+DELETE FROM pgagent.pga_job WHERE jobname='job2';
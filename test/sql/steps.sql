@@ -0,0 +1,42 @@
+-- The bookkeeping of a job run, as done by pga_job_steps(), pga_step_begin(),
+-- pga_step_end() and pga_job_end().
+INSERT INTO pgagent.pga_jobagent (jagpid, jagstation)
+ SELECT pg_backend_pid(), 'regression'
+ WHERE NOT EXISTS (SELECT 1 FROM pgagent.pga_jobagent WHERE jagpid = pg_backend_pid());
+INSERT INTO pgagent.pga_job (jobjclid, jobname, jobdesc, jobenabled, jobhostagent, jobagentid, jobsteptimeout)
+ SELECT jclid, 'stepsjob', '', true, '', pg_backend_pid(), '2 seconds'
+  FROM pgagent.pga_jobclass WHERE jclname='Miscellaneous';
+INSERT INTO pgagent.pga_jobstep (jstjobid, jstname, jstdesc, jstenabled, jstkind, jstonerror, jstcode, jstdbname, jstconnstr, jsttimeout)
+ SELECT jobid, s.name, '', s.enabled, 's', 'f', s.code, 'contrib_regression', '', s.timeout
+  FROM pgagent.pga_job,
+       (VALUES ('b', true, 'SELECT 2', NULL::interval), ('a', true, 'SELECT 1', interval '500 milliseconds'),
+               ('c', false, 'SELECT 3', NULL)) s(name, enabled, code, timeout)
+ WHERE jobname='stepsjob';
+INSERT INTO pgagent.pga_joblog (jlgjobid)
+ SELECT jobid FROM pgagent.pga_job WHERE jobname='stepsjob';
+-- The enabled steps, in the order they are run, with their time limit in ms
+SELECT S.jstcode, S.timeout
+  FROM pgagent.pga_job_steps((SELECT jobid FROM pgagent.pga_job WHERE jobname='stepsjob')) S;
+-- Run the first one
+CREATE TEMP TABLE run AS
+ SELECT pgagent.pga_step_begin(L.jlgid, S.jstid) AS jslid
+  FROM pgagent.pga_joblog L JOIN pgagent.pga_jobstep S ON S.jstjobid = L.jlgjobid
+ WHERE S.jstname = 'a'
+   AND L.jlgjobid = (SELECT jobid FROM pgagent.pga_job WHERE jobname='stepsjob');
+SELECT jslstatus, jslduration IS NULL AS running
+  FROM pgagent.pga_jobsteplog WHERE jslid = (SELECT jslid FROM run);
+SELECT pgagent.pga_step_end(jslid, 1, 's', 'done') AS found FROM run;
+SELECT jslstatus, jslresult, jsloutput, jslduration IS NULL AS running
+  FROM pgagent.pga_jobsteplog WHERE jslid = (SELECT jslid FROM run);
+-- A step which doesn't exist any more isn't logged, nor one which wasn't
+SELECT pgagent.pga_step_begin(L.jlgid, -1) IS NULL AS not_logged
+  FROM pgagent.pga_joblog L
+ WHERE L.jlgjobid = (SELECT jobid FROM pgagent.pga_job WHERE jobname='stepsjob');
+SELECT pgagent.pga_step_end(-1, 1, 's', '') AS found;
+-- The end of the run is logged, and the job given back
+SELECT pgagent.pga_job_end(L.jlgjobid, L.jlgid, 's') AS found
+  FROM pgagent.pga_joblog L
+ WHERE L.jlgjobid = (SELECT jobid FROM pgagent.pga_job WHERE jobname='stepsjob');
+SELECT L.jlgstatus, L.jlgduration IS NULL AS running, J.jobagentid IS NULL AS released
+  FROM pgagent.pga_joblog L JOIN pgagent.pga_job J ON J.jobid = L.jlgjobid
+ WHERE J.jobname='stepsjob';
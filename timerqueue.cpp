@@ -0,0 +1,133 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// pgAgent - PostgreSQL Tools
+//
+// Copyright (C) 2002 - 2024, The pgAdmin Development Team
+// This software is released under the PostgreSQL Licence
+//
+// timerqueue.cpp - next run times of the jobs known to the agent
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pgAgent.h"
+
+
+void TimerQueue::Set(const std::string &jobid, const time_point &due)
+{
+	std::unordered_map<std::string, size_t>::iterator it = m_index.find(jobid);
+
+	if (it == m_index.end())
+	{
+		Entry entry = { due, jobid };
+
+		m_heap.push_back(entry);
+		m_index[jobid] = m_heap.size() - 1;
+		SiftUp(m_heap.size() - 1);
+
+		return;
+	}
+
+	size_t pos = it->second;
+	bool   earlier = due < m_heap[pos].due;
+
+	m_heap[pos].due = due;
+
+	if (earlier)
+		SiftUp(pos);
+	else
+		SiftDown(pos);
+}
+
+
+void TimerQueue::Remove(const std::string &jobid)
+{
+	std::unordered_map<std::string, size_t>::iterator it = m_index.find(jobid);
+
+	if (it == m_index.end())
+		return;
+
+	size_t pos = it->second;
+	size_t last = m_heap.size() - 1;
+
+	if (pos != last)
+	{
+		Swap(pos, last);
+		m_heap.pop_back();
+		m_index.erase(jobid);
+
+		// The entry moved from the end can go either way
+		SiftUp(pos);
+		SiftDown(pos);
+	}
+	else
+	{
+		m_heap.pop_back();
+		m_index.erase(jobid);
+	}
+}
+
+
+void TimerQueue::Clear()
+{
+	m_heap.clear();
+	m_index.clear();
+}
+
+
+bool TimerQueue::PopDue(const time_point &now, std::string &jobid)
+{
+	if (m_heap.empty() || m_heap.front().due > now)
+		return false;
+
+	jobid = m_heap.front().jobid;
+	Remove(jobid);
+
+	return true;
+}
+
+
+void TimerQueue::Swap(size_t a, size_t b)
+{
+	std::swap(m_heap[a], m_heap[b]);
+	m_index[m_heap[a].jobid] = a;
+	m_index[m_heap[b].jobid] = b;
+}
+
+
+void TimerQueue::SiftUp(size_t pos)
+{
+	while (pos > 0)
+	{
+		size_t parent = (pos - 1) / 2;
+
+		if (!(m_heap[pos].due < m_heap[parent].due))
+			break;
+
+		Swap(pos, parent);
+		pos = parent;
+	}
+}
+
+
+void TimerQueue::SiftDown(size_t pos)
+{
+	size_t size = m_heap.size();
+
+	while (true)
+	{
+		size_t left = 2 * pos + 1;
+		size_t right = left + 1;
+		size_t smallest = pos;
+
+		if (left < size && m_heap[left].due < m_heap[smallest].due)
+			smallest = left;
+		if (right < size && m_heap[right].due < m_heap[smallest].due)
+			smallest = right;
+
+		if (smallest == pos)
+			break;
+
+		Swap(pos, smallest);
+		pos = smallest;
+	}
+}
@@ -16,10 +16,7 @@
 
 #include <iostream>
 #include <fcntl.h>
-#include <fstream>
-
-static boost::mutex s_loggerLock;
-bool printFileErrorMsg = true;
+#include <signal.h>
 
 using namespace std;
 
@@ -38,82 +35,56 @@ void usage(const std::string &appName)
 	fprintf(stdout, "-r <retry period after connection abort in seconds (>=10, default 30)>\n");
 	fprintf(stdout, "-s <log file (messages are logged to STDOUT if not specified>\n");
 	fprintf(stdout, "-l <logging verbosity (ERROR=0, WARNING=1, DEBUG=2, default 0)>\n");
+	fprintf(stdout, "--max-wait=<longest wait in seconds for job notifications before checking anyway (default 60)>\n");
+	fprintf(stdout, "--workers=<number of threads running the jobs (default 10)>\n");
+	fprintf(stdout, "--max-jobs=<number of jobs run at the same time; SQL steps don't hold a worker, so it may be above --workers (default --workers)>\n");
+	fprintf(stdout, "--reserved-workers=<number of the --max-jobs kept for jobs with a priority above 0 (default 0)>\n");
+	fprintf(stdout, "--pool-min-idle=<number of idle connections kept open per database in use (default 0)>\n");
+	fprintf(stdout, "--pool-max-idle=<largest number of idle connections kept open per database (default 5)>\n");
+	fprintf(stdout, "--pool-idle-timeout=<seconds after which extra idle connections are closed, 0 for never (default 300)>\n");
+	fprintf(stdout, "--pool-max-lifetime=<seconds after which connections are closed once idle, 0 for never (default 3600)>\n");
+	fprintf(stdout, "--pool-prewarm=<seconds ahead of their jobs to open the connections they need, 0 to disable (default 0)>\n");
+	fprintf(stdout, "--connect-timeout=<seconds to wait for a connection to be made, 0 for no limit (default 30)>\n");
+	fprintf(stdout, "--log-buffer=<number of messages waiting to be logged, beyond which they are dropped or waited for (default 4096)>\n");
+	fprintf(stdout, "--log-when-full=<drop or wait, when the log buffer is full (default drop)>\n");
+	fprintf(stdout, "--log-format=<text, or json for one JSON object per message (default text)>\n");
+	fprintf(stdout, "--log-rotate-size=<size in MB beyond which the log file is rotated, 0 for no limit (default 0)>\n");
+	fprintf(stdout, "--log-rotate-age=<seconds after which the log file is rotated, 0 for no limit (default 0)>\n");
+	fprintf(stdout, "--log-rotate-keep=<number of rotated log files kept, 0 for all (default 5)>\n");
+	fprintf(stdout, "--log-rotate-compress=<1 to gzip the rotated log files, if built with zlib (default 0)>\n");
 }
 
 void LogMessage(const std::string &msg, const int &level)
 {
-	std::ofstream out;
-	bool writeToStdOut = false;
-	MutexLocker locker(&s_loggerLock);
-
-	if (!logFile.empty())
-	{
-		std::string log_file(logFile.begin(), logFile.end());
-		out.open((const char *)log_file.c_str(), ios::out | ios::app);
-		if (!out.is_open())
-		{
-			if (printFileErrorMsg)
-			{
-				fprintf(stderr, "Can not open the logfile '%s'", log_file.c_str());
-				printFileErrorMsg = false;
-			}
-			return;
-		} else {
-			printFileErrorMsg = true;
-		}
-	}
-	else
-		writeToStdOut = true;
-
-	boost::gregorian::date current_date(boost::gregorian::day_clock::local_day());
-
-	std::string day_week = boost::lexical_cast<std::string>(current_date.day_of_week());
-	std::string year = boost::lexical_cast<std::string>(current_date.year());
-	std::string month = boost::lexical_cast<std::string>(current_date.month());
-	std::string day = boost::lexical_cast<std::string>(current_date.day());
-
-	boost::posix_time::ptime pt = boost::posix_time::second_clock::local_time();
-	std::string time_day = boost::lexical_cast<std::string>(pt.time_of_day());
-
-	std::string logTimeString = "";
-	logTimeString = day_week + " " + month + " " + day + " " + time_day + " " + year + " ";
-
 	switch (level)
 	{
 		case LOG_DEBUG:
 			if (minLogLevel >= LOG_DEBUG)
-				(writeToStdOut ? std::cout : out) << logTimeString <<
-					"DEBUG: " << msg << std::endl;
+				Logger::Get().Write(LOG_DEBUG, msg);
 			break;
 		case LOG_WARNING:
 			if (minLogLevel >= LOG_WARNING)
-				(writeToStdOut ? std::cout : out) << logTimeString <<
-					"WARNING: " << msg << std::endl;
+				Logger::Get().Write(LOG_WARNING, msg);
 			break;
 		case LOG_ERROR:
-			(writeToStdOut ? std::cout : out) << logTimeString <<
-				"ERROR: " << msg << std::endl;
-
-			// On system exit, boost::mutex object calls
-			// pthread_mutex_destroy(...) on the underlying native mutex object.
-			// But - it returns errorcode 'BUSY' instead of 0. Because - it was
-			// still keeping the lock on the resource. And, that results into
-			// an assertion in debug mode.
-			//
-			// Hence - we need to unlock the mutex before calling system exit.
-			locker = (boost::mutex *)NULL;
+			// Not to be lost, whatever the state of the buffer: it is the
+			// last one.
+			Logger::Get().Write(LOG_ERROR, msg, true);
+			Logger::Get().Flush();
 			exit(1);
 			break;
 		case LOG_STARTUP:
-			(writeToStdOut ? std::cout : out) << logTimeString <<
-				"WARNING: " << msg << std::endl;
+			Logger::Get().Write(LOG_STARTUP, msg, true);
 			break;
 	}
+}
 
-	if (!logFile.empty())
-	{
-		out.close();
-	}
+
+// SIGHUP has the log file opened again, so that it can be moved away, e.g.
+// by logrotate, without losing any message
+static void ReopenLogFile(int)
+{
+	Logger::RequestReopen();
 }
 
 
@@ -122,6 +93,9 @@ static void daemonize(void)
 {
 	pid_t pid;
 
+	// The log writer would not survive the fork
+	Logger::Get().Stop();
+
 	pid = fork();
 	if (pid == (pid_t)-1)
 	{
@@ -159,6 +133,14 @@ int main(int argc, char **argv)
 
 	setOptions(argc, argv, executable);
 
+	struct sigaction action;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = ReopenLogFile;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	sigaction(SIGHUP, &action, NULL);
+
 	if (!runInForeground)
 		daemonize();
 
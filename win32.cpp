@@ -489,6 +489,16 @@ void usage(const std::string &executable)
 	printf("-t <poll time interval in seconds (default 10)>\n");
 	printf("-r <retry period after connection abort in seconds (>=10, default 30)>\n");
 	printf("-l <logging verbosity (ERROR=0, WARNING=1, DEBUG=2, default 0)>\n");
+	printf("--max-wait=<longest wait in seconds for job notifications before checking anyway (default 60)>\n");
+	printf("--workers=<number of threads running the jobs (default 10)>\n");
+	printf("--max-jobs=<number of jobs run at the same time; SQL steps don't hold a worker, so it may be above --workers (default --workers)>\n");
+	printf("--reserved-workers=<number of the --max-jobs kept for jobs with a priority above 0 (default 0)>\n");
+	printf("--pool-min-idle=<number of idle connections kept open per database in use (default 0)>\n");
+	printf("--pool-max-idle=<largest number of idle connections kept open per database (default 5)>\n");
+	printf("--pool-idle-timeout=<seconds after which extra idle connections are closed, 0 for never (default 300)>\n");
+	printf("--pool-max-lifetime=<seconds after which connections are closed once idle, 0 for never (default 3600)>\n");
+	printf("--pool-prewarm=<seconds ahead of their jobs to open the connections they need, 0 to disable (default 0)>\n");
+	printf("--connect-timeout=<seconds to wait for a connection to be made, 0 for no limit (default 30)>\n");
 }
 
 
@@ -0,0 +1,114 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// pgAgent - PostgreSQL Tools
+//
+// Copyright (C) 2002 - 2024, The pgAdmin Development Team
+// This software is released under the PostgreSQL Licence
+//
+// workerpool.cpp - fixed set of threads running the jobs
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "pgAgent.h"
+
+
+WorkerPool::WorkerPool(size_t workers, size_t slots)
+	: m_busy(0), m_slots(slots), m_taken(0), m_stopping(false)
+{
+	for (size_t i = 0; i < workers; i++)
+		m_workers.push_back(new boost::thread(&WorkerPool::Run, this));
+
+	LOG_MESSAGE(
+		(boost::format("Started %d worker thread(s) for up to %d jobs") %
+		 workers % slots).str(), LOG_DEBUG
+	);
+}
+
+
+WorkerPool::~WorkerPool()
+{
+	{
+		boost::unique_lock<boost::mutex> locker(m_lock);
+		m_stopping = true;
+	}
+	m_cond.notify_all();
+
+	for (size_t i = 0; i < m_workers.size(); i++)
+	{
+		m_workers[i]->join();
+		delete m_workers[i];
+	}
+}
+
+
+bool WorkerPool::Submit(const Task &task)
+{
+	{
+		boost::unique_lock<boost::mutex> locker(m_lock);
+
+		if (m_taken >= m_slots)
+			return false;
+
+		m_taken++;
+		m_queue.push_back(task);
+	}
+	m_cond.notify_one();
+
+	return true;
+}
+
+
+void WorkerPool::Resume(const Task &task)
+{
+	{
+		boost::unique_lock<boost::mutex> locker(m_lock);
+		m_queue.push_back(task);
+	}
+	m_cond.notify_one();
+}
+
+
+void WorkerPool::Release()
+{
+	boost::unique_lock<boost::mutex> locker(m_lock);
+
+	if (m_taken > 0)
+		m_taken--;
+}
+
+
+size_t WorkerPool::Available()
+{
+	boost::unique_lock<boost::mutex> locker(m_lock);
+
+	return m_taken < m_slots ? m_slots - m_taken : 0;
+}
+
+
+void WorkerPool::Run()
+{
+	boost::unique_lock<boost::mutex> locker(m_lock);
+
+	while (true)
+	{
+		while (m_queue.empty() && !m_stopping)
+			m_cond.wait(locker);
+
+		if (m_queue.empty())
+			break;
+
+		Task task = m_queue.front();
+
+		m_queue.pop_front();
+		m_busy++;
+
+		locker.unlock();
+		task();
+		// The task may hold the last reference to a job, whose end must not
+		// happen with the lock held
+		task = Task();
+		locker.lock();
+
+		m_busy--;
+	}
+}